@@ -98,6 +98,19 @@ static inline uint64_t s3k_read_cap(uint64_t cidx, cap_t* cap)
     return a0;
 }
 
+/* Capability operation of s3k_batch, op is a BATCH_OP_* */
+typedef struct s3k_cap_op {
+    uint64_t op;
+    uint64_t arg[4];
+    uint64_t status;
+} s3k_cap_op_t;
+
+/* Run n capability operations in order, each gets its own status */
+static inline uint64_t s3k_batch(s3k_cap_op_t* ops, uint64_t n)
+{
+    return S3K_SYSCALL2(S3K_SYSNR_BATCH, (uint64_t)ops, n);
+}
+
 static inline uint64_t s3k_move_cap(uint64_t cidx_src, uint64_t cidx_dest)
 {
     return S3K_SYSCALL2(S3K_SYSNR_MOVE_CAP, cidx_src, cidx_dest);
@@ -182,6 +195,21 @@ static inline uint64_t s3k_supervisor_take_cap(uint64_t sup_cid, uint64_t pid, u
     return S3K_SYSCALL5(S3K_SYSNR_INVOKE_CAP, sup_cid, pid, S3K_SYSNR_INVOKE_SUPERVISOR_TAKE_CAP, src, dest);
 }
 
+static inline uint64_t s3k_supervisor_save_mode(uint64_t sup_cid, uint64_t mode)
+{
+    return S3K_SYSCALL4(S3K_SYSNR_INVOKE_CAP, sup_cid, 0, S3K_SYSNR_INVOKE_SUPERVISOR_SAVE_MODE, mode);
+}
+
+static inline uint64_t s3k_supervisor_load_mode(uint64_t sup_cid, uint64_t mode)
+{
+    return S3K_SYSCALL4(S3K_SYSNR_INVOKE_CAP, sup_cid, 0, S3K_SYSNR_INVOKE_SUPERVISOR_LOAD_MODE, mode);
+}
+
+static inline uint64_t s3k_time_set_background(uint64_t time_cid, uint64_t pid)
+{
+    return S3K_SYSCALL2(S3K_SYSNR_INVOKE_CAP, time_cid, pid);
+}
+
 static inline uint64_t s3k_receive(uint64_t cid, uint64_t msg[4], uint64_t dest)
 {
     register uint64_t a0 __asm__("a0");
@@ -207,6 +235,220 @@ static inline uint64_t s3k_send(uint64_t cid, uint64_t msg[4], uint64_t src)
     return S3K_SYSCALL6(S3K_SYSNR_INVOKE_CAP, cid, msg[0], msg[1], msg[2], msg[3], src);
 }
 
+/* Like s3k_send, also copies len words from the IPC buffer to the receiver's */
+static inline uint64_t s3k_send_ipc(uint64_t cid, uint64_t msg[4], uint64_t src, uint64_t len)
+{
+    return S3K_SYSCALL8(S3K_SYSNR_INVOKE_CAP, cid, msg[0], msg[1], msg[2], msg[3], src, 0, len);
+}
+
+static inline uint64_t s3k_try_send(uint64_t cid, uint64_t msg[4], uint64_t src)
+{
+    return S3K_SYSCALL7(S3K_SYSNR_INVOKE_CAP, cid, msg[0], msg[1], msg[2], msg[3], src, SEND_FLAG_NONBLOCK);
+}
+
+static inline uint64_t s3k_client_call(uint64_t cid, uint64_t msg[4], uint64_t src, uint64_t donate)
+{
+    register uint64_t a0 __asm__("a0");
+    register uint64_t a1 __asm__("a1");
+    register uint64_t a2 __asm__("a2");
+    register uint64_t a3 __asm__("a3");
+    register uint64_t a4 __asm__("a4");
+    register uint64_t a5 __asm__("a5");
+    register uint64_t a6 __asm__("a6");
+    register uint64_t a7 __asm__("a7");
+    register uint64_t t0 __asm__("t0");
+    a0 = cid;
+    a1 = msg[0];
+    a2 = msg[1];
+    a3 = msg[2];
+    a4 = msg[3];
+    a5 = src;
+    a6 = donate;
+    a7 = 0;
+    t0 = S3K_SYSNR_INVOKE_CAP;
+    __asm__ volatile("ecall"
+                     : "+r"(a0), "+r"(a1), "+r"(a2), "+r"(a3), "+r"(a4)
+                     : "r"(a5), "r"(a6), "r"(a7), "r"(t0));
+    msg[0] = (a0 == S3K_OK) ? a1 : 0;
+    msg[1] = (a0 == S3K_OK) ? a2 : 0;
+    msg[2] = (a0 == S3K_OK) ? a3 : 0;
+    msg[3] = (a0 == S3K_OK) ? a4 : 0;
+    return a0;
+}
+
+/* Send msg to every receiver waiting on the channels of a multicast capability, never blocks */
+static inline uint64_t s3k_multicast(uint64_t cid, uint64_t msg[4], uint64_t flags)
+{
+    return S3K_SYSCALL6(S3K_SYSNR_INVOKE_CAP, cid, msg[0], msg[1], msg[2], msg[3], flags);
+}
+
+/* Call without sending a capability, and len words of the IPC buffer */
+static inline uint64_t s3k_call(uint64_t cid, uint64_t msg[4], uint64_t donate, uint64_t len)
+{
+    register uint64_t a0 __asm__("a0");
+    register uint64_t a1 __asm__("a1");
+    register uint64_t a2 __asm__("a2");
+    register uint64_t a3 __asm__("a3");
+    register uint64_t a4 __asm__("a4");
+    register uint64_t a5 __asm__("a5");
+    register uint64_t a6 __asm__("a6");
+    register uint64_t a7 __asm__("a7");
+    register uint64_t t0 __asm__("t0");
+    a0 = cid;
+    a1 = msg[0];
+    a2 = msg[1];
+    a3 = msg[2];
+    a4 = msg[3];
+    a5 = -1; /* No capability, the kernel overwrites a5 */
+    a6 = donate;
+    a7 = len;
+    t0 = S3K_SYSNR_CALL;
+    __asm__ volatile("ecall"
+                     : "+r"(a0), "+r"(a1), "+r"(a2), "+r"(a3), "+r"(a4), "+r"(a5)
+                     : "r"(a6), "r"(a7), "r"(t0));
+    msg[0] = (a0 == S3K_OK) ? a1 : 0;
+    msg[1] = (a0 == S3K_OK) ? a2 : 0;
+    msg[2] = (a0 == S3K_OK) ? a3 : 0;
+    msg[3] = (a0 == S3K_OK) ? a4 : 0;
+    return a0;
+}
+
+/* Reply msg and len words of the IPC buffer to the current client of a server capability,
+ * and wait for the next call in msg */
+static inline uint64_t s3k_reply_recv(uint64_t cid, uint64_t msg[4], uint64_t len)
+{
+    register uint64_t a0 __asm__("a0");
+    register uint64_t a1 __asm__("a1");
+    register uint64_t a2 __asm__("a2");
+    register uint64_t a3 __asm__("a3");
+    register uint64_t a4 __asm__("a4");
+    register uint64_t a5 __asm__("a5");
+    register uint64_t t0 __asm__("t0");
+    a0 = cid;
+    a1 = msg[0];
+    a2 = msg[1];
+    a3 = msg[2];
+    a4 = msg[3];
+    a5 = len;
+    t0 = S3K_SYSNR_REPLY_RECV;
+    __asm__ volatile("ecall" : "+r"(a0), "+r"(a1), "+r"(a2), "+r"(a3), "+r"(a4) : "r"(a5), "r"(t0));
+    msg[0] = (a0 == S3K_OK) ? a1 : 0;
+    msg[1] = (a0 == S3K_OK) ? a2 : 0;
+    msg[2] = (a0 == S3K_OK) ? a3 : 0;
+    msg[3] = (a0 == S3K_OK) ? a4 : 0;
+    return a0;
+}
+
+/*
+ * IPC buffer, the start of a pmp region registered in virtual register
+ * ipc_cidx. Sends, calls and replies copy up to N_IPC_WORDS words after
+ * len, len is set to the number of words received.
+ */
+typedef struct s3k_ipc_buffer {
+    volatile uint64_t len;
+    volatile uint64_t words[];
+} s3k_ipc_buffer_t;
+
+/* Wake the receiver of a sender capability, or latch the wake-up if it is not waiting */
+static inline uint64_t s3k_doorbell(uint64_t cid)
+{
+    return S3K_SYSCALL7(S3K_SYSNR_INVOKE_CAP, cid, 0, 0, 0, 0, -1, SEND_FLAG_LATCH);
+}
+
+/* Set bits on a notification channel, never blocks */
+static inline uint64_t s3k_notify(uint64_t cid, uint64_t bits)
+{
+    return S3K_SYSCALL2(S3K_SYSNR_INVOKE_CAP, cid, bits);
+}
+
+/* Take the pending bits of a notification channel, waits for bits if wait != 0 */
+static inline uint64_t s3k_notification_take(uint64_t cid, uint64_t wait, uint64_t* bits)
+{
+    register int64_t a0 __asm__("a0");
+    register uint64_t a1 __asm__("a1");
+    register uint64_t t0 __asm__("t0");
+    a0 = cid;
+    a1 = wait;
+    t0 = S3K_SYSNR_INVOKE_CAP;
+    __asm__ volatile("ecall" : "+r"(a0), "+r"(a1) : "r"(t0));
+    *bits = a1;
+    return a0;
+}
+
+static inline uint64_t s3k_notification_wait(uint64_t cid, uint64_t* bits)
+{
+    return s3k_notification_take(cid, 1, bits);
+}
+
+static inline uint64_t s3k_notification_poll(uint64_t cid, uint64_t* bits)
+{
+    return s3k_notification_take(cid, 0, bits);
+}
+
+/*
+ * Single-producer/single-consumer ring in memory shared by two processes
+ * through pmp capabilities. The processes copy data without system calls,
+ * the kernel is only used to wake a consumer waiting on an empty ring, through
+ * a sender (producer) and receiver (consumer) capability of one channel.
+ * size must be a power of two.
+ */
+typedef struct s3k_ring {
+    volatile uint64_t head;
+    volatile uint64_t tail;
+    /* Consumer is about to wait, or waiting, for data */
+    volatile uint64_t waiting;
+    uint64_t size;
+    uint8_t buf[];
+} s3k_ring_t;
+
+static inline void s3k_ring_init(s3k_ring_t* ring, uint64_t size)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->waiting = 0;
+    ring->size = size;
+}
+
+/* Write at most len bytes, returns the number written. Producer only. */
+static inline uint64_t s3k_ring_write(s3k_ring_t* ring, uint64_t sender_cid, const void* data, uint64_t len)
+{
+    const uint8_t* src = data;
+    uint64_t head = ring->head;
+    uint64_t space = ring->size - (head - ring->tail);
+    uint64_t n = len < space ? len : space;
+    for (uint64_t i = 0; i < n; i++)
+        ring->buf[(head + i) & (ring->size - 1)] = src[i];
+    __sync_synchronize();
+    ring->head = head + n;
+    __sync_synchronize();
+    if (n > 0 && ring->waiting)
+        s3k_doorbell(sender_cid);
+    return n;
+}
+
+/* Read at most len bytes, waits until at least one byte is available. Consumer only. */
+static inline uint64_t s3k_ring_read(s3k_ring_t* ring, uint64_t receiver_cid, void* data, uint64_t len)
+{
+    uint8_t* dst = data;
+    uint64_t tail = ring->tail;
+    uint64_t msg[4];
+    while (ring->head == tail) {
+        ring->waiting = 1;
+        __sync_synchronize();
+        if (ring->head == tail)
+            s3k_receive(receiver_cid, msg, -1);
+        ring->waiting = 0;
+    }
+    __sync_synchronize();
+    uint64_t avail = ring->head - tail;
+    uint64_t n = len < avail ? len : avail;
+    for (uint64_t i = 0; i < n; i++)
+        dst[i] = ring->buf[(tail + i) & (ring->size - 1)];
+    __sync_synchronize();
+    ring->tail = tail + n;
+    return n;
+}
+
 static inline int s3k_dump_cap(char* buf, int n, cap_t cap)
 {
     switch (cap_get_type(cap)) {
@@ -236,6 +478,12 @@ static inline int s3k_dump_cap(char* buf, int n, cap_t cap)
     case CAP_TYPE_SUPERVISOR:
         return snprintf(buf, n, "SUPERVISOR{begin=%ld,end=%ld,free=%ld}", cap_supervisor_get_begin(cap),
                         cap_supervisor_get_end(cap), cap_supervisor_get_free(cap));
+    case CAP_TYPE_NOTIFICATION:
+        return snprintf(buf, n, "NOTIFICATION{channel=%ld,receive=%ld}", cap_notification_get_channel(cap),
+                        cap_notification_get_receive(cap));
+    case CAP_TYPE_MULTICAST:
+        return snprintf(buf, n, "MULTICAST{begin=%ld,end=%ld}", cap_multicast_get_begin(cap),
+                        cap_multicast_get_end(cap));
     default:
         return snprintf(buf, n, "INVALID");
     }
@@ -2,6 +2,7 @@
 #include <stdint.h>
 
 #define NULL_CAP ((cap_t){0, 0})
+#define CAP_TYPE_PAIR(p, c) ((p) * NUM_OF_CAP_TYPES + (c))
 
 typedef enum cap_type cap_type_t;
 typedef struct cap cap_t;
@@ -17,6 +18,8 @@ enum cap_type {
     CAP_TYPE_SERVER,
     CAP_TYPE_CLIENT,
     CAP_TYPE_SUPERVISOR,
+    CAP_TYPE_NOTIFICATION,
+    CAP_TYPE_MULTICAST,
     NUM_OF_CAP_TYPES
 };
 
@@ -357,89 +360,182 @@ static inline cap_t cap_supervisor_set_free(cap_t cap, uint64_t free)
     cap.word0 = (cap.word0 & ~0xff00ull) | free << 8;
     return cap;
 }
+static inline cap_t cap_mk_notification(uint64_t channel, uint64_t receive)
+{
+    cap_t c;
+    c.word0 = (uint64_t)CAP_TYPE_NOTIFICATION;
+    c.word1 = 0;
+    c.word0 |= receive << 8;
+    c.word0 |= channel << 16;
+    return c;
+}
+static inline uint64_t cap_notification_get_channel(cap_t cap)
+{
+    return (cap.word0 >> 16) & 0xffffull;
+}
+static inline cap_t cap_notification_set_channel(cap_t cap, uint64_t channel)
+{
+    cap.word0 = (cap.word0 & ~0xffff0000ull) | channel << 16;
+    return cap;
+}
+static inline uint64_t cap_notification_get_receive(cap_t cap)
+{
+    return (cap.word0 >> 8) & 0xffull;
+}
+static inline cap_t cap_notification_set_receive(cap_t cap, uint64_t receive)
+{
+    cap.word0 = (cap.word0 & ~0xff00ull) | receive << 8;
+    return cap;
+}
+static inline cap_t cap_mk_multicast(uint64_t begin, uint64_t end)
+{
+    cap_t c;
+    c.word0 = (uint64_t)CAP_TYPE_MULTICAST;
+    c.word1 = 0;
+    c.word0 |= end << 8;
+    c.word0 |= begin << 24;
+    return c;
+}
+static inline uint64_t cap_multicast_get_begin(cap_t cap)
+{
+    return (cap.word0 >> 24) & 0xffffull;
+}
+static inline cap_t cap_multicast_set_begin(cap_t cap, uint64_t begin)
+{
+    cap.word0 = (cap.word0 & ~0xffff000000ull) | begin << 24;
+    return cap;
+}
+static inline uint64_t cap_multicast_get_end(cap_t cap)
+{
+    return (cap.word0 >> 8) & 0xffffull;
+}
+static inline cap_t cap_multicast_set_end(cap_t cap, uint64_t end)
+{
+    cap.word0 = (cap.word0 & ~0xffff00ull) | end << 8;
+    return cap;
+}
 static inline int cap_is_revokable(cap_t cap)
 {
     return cap_is_type(cap, CAP_TYPE_MEMORY) && cap_is_type(cap, CAP_TYPE_TIME) &&
            cap_is_type(cap, CAP_TYPE_CHANNELS) && cap_is_type(cap, CAP_TYPE_RECEIVER) &&
            cap_is_type(cap, CAP_TYPE_SENDER) && cap_is_type(cap, CAP_TYPE_SERVER) &&
-           cap_is_type(cap, CAP_TYPE_CLIENT) && cap_is_type(cap, CAP_TYPE_SUPERVISOR);
+           cap_is_type(cap, CAP_TYPE_CLIENT) && cap_is_type(cap, CAP_TYPE_SUPERVISOR) &&
+           cap_is_type(cap, CAP_TYPE_NOTIFICATION) && cap_is_type(cap, CAP_TYPE_MULTICAST);
 }
 static inline int cap_is_child(cap_t p, cap_t c)
 {
-    if (cap_is_type(p, CAP_TYPE_MEMORY) && cap_is_type(c, CAP_TYPE_MEMORY))
+    uint64_t pt = cap_get_type(p), ct = cap_get_type(c);
+    if (pt >= NUM_OF_CAP_TYPES || ct >= NUM_OF_CAP_TYPES)
+        return 0;
+    switch (CAP_TYPE_PAIR(pt, ct)) {
+    case CAP_TYPE_PAIR(CAP_TYPE_MEMORY, CAP_TYPE_MEMORY):
         return (cap_memory_get_begin(p) <= cap_memory_get_begin(c)) &&
                (cap_memory_get_end(c) <= cap_memory_get_free(p)) &&
                ((cap_memory_get_rwx(c) & cap_memory_get_rwx(p)) == cap_memory_get_rwx(c));
-    if (cap_is_type(p, CAP_TYPE_MEMORY) && cap_is_type(c, CAP_TYPE_PMP))
+    case CAP_TYPE_PAIR(CAP_TYPE_MEMORY, CAP_TYPE_PMP):
         return (cap_memory_get_free(p) <= pmp_napot_begin(cap_pmp_get_addr(c))) &&
                (pmp_napot_end(cap_pmp_get_addr(c)) <= cap_memory_get_end(p)) && (cap_memory_get_pmp(p) == 1) &&
                ((cap_pmp_get_rwx(c) & cap_memory_get_rwx(p)) == cap_pmp_get_rwx(c));
-    if (cap_is_type(p, CAP_TYPE_TIME) && cap_is_type(c, CAP_TYPE_TIME))
+    case CAP_TYPE_PAIR(CAP_TYPE_TIME, CAP_TYPE_TIME):
         return (cap_time_get_begin(p) <= cap_time_get_begin(c)) && (cap_time_get_end(c) <= cap_time_get_free(p)) &&
                (cap_time_get_hartid(p) == cap_time_get_hartid(c));
-    if (cap_is_type(p, CAP_TYPE_CHANNELS) && cap_is_type(c, CAP_TYPE_CHANNELS))
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_CHANNELS):
         return (cap_channels_get_begin(p) <= cap_channels_get_begin(c)) &&
                (cap_channels_get_end(c) <= cap_channels_get_free(p));
-    if (cap_is_type(p, CAP_TYPE_CHANNELS) && cap_is_type(c, CAP_TYPE_RECEIVER))
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_RECEIVER):
         return (cap_channels_get_begin(p) <= cap_receiver_get_channel(c)) &&
                (cap_receiver_get_channel(c) < cap_channels_get_free(p));
-    if (cap_is_type(p, CAP_TYPE_CHANNELS) && cap_is_type(c, CAP_TYPE_SENDER))
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_SENDER):
         return (cap_channels_get_begin(p) <= cap_sender_get_channel(c)) &&
                (cap_sender_get_channel(c) < cap_channels_get_free(p));
-    if (cap_is_type(p, CAP_TYPE_CHANNELS) && cap_is_type(c, CAP_TYPE_SERVER))
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_SERVER):
         return (cap_channels_get_begin(p) <= cap_server_get_channel(c)) &&
                (cap_server_get_channel(c) < cap_channels_get_free(p));
-    if (cap_is_type(p, CAP_TYPE_CHANNELS) && cap_is_type(c, CAP_TYPE_CLIENT))
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_CLIENT):
         return (cap_channels_get_begin(p) <= cap_client_get_channel(c)) &&
                (cap_client_get_channel(c) < cap_channels_get_free(p));
-    if (cap_is_type(p, CAP_TYPE_RECEIVER) && cap_is_type(c, CAP_TYPE_SENDER))
+    case CAP_TYPE_PAIR(CAP_TYPE_RECEIVER, CAP_TYPE_SENDER):
         return (cap_receiver_get_channel(p) == cap_sender_get_channel(c));
-    if (cap_is_type(p, CAP_TYPE_SERVER) && cap_is_type(c, CAP_TYPE_CLIENT))
+    case CAP_TYPE_PAIR(CAP_TYPE_SERVER, CAP_TYPE_CLIENT):
         return (cap_server_get_channel(p) == cap_client_get_channel(c));
-    if (cap_is_type(p, CAP_TYPE_SUPERVISOR) && cap_is_type(c, CAP_TYPE_SUPERVISOR))
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_NOTIFICATION):
+        return (cap_channels_get_begin(p) <= cap_notification_get_channel(c)) &&
+               (cap_notification_get_channel(c) < cap_channels_get_free(p));
+    case CAP_TYPE_PAIR(CAP_TYPE_NOTIFICATION, CAP_TYPE_NOTIFICATION):
+        return (cap_notification_get_channel(p) == cap_notification_get_channel(c)) &&
+               (cap_notification_get_receive(p) == 1) && (cap_notification_get_receive(c) == 0);
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_MULTICAST):
+        return (cap_channels_get_begin(p) <= cap_multicast_get_begin(c)) &&
+               (cap_multicast_get_end(c) <= cap_channels_get_free(p));
+    case CAP_TYPE_PAIR(CAP_TYPE_MULTICAST, CAP_TYPE_MULTICAST):
+        return (cap_multicast_get_begin(p) <= cap_multicast_get_begin(c)) &&
+               (cap_multicast_get_end(c) <= cap_multicast_get_end(p));
+    case CAP_TYPE_PAIR(CAP_TYPE_SUPERVISOR, CAP_TYPE_SUPERVISOR):
         return (cap_supervisor_get_begin(p) <= cap_supervisor_get_begin(c)) &&
                (cap_supervisor_get_end(c) <= cap_supervisor_get_free(p));
-    return 0;
+    default:
+        return 0;
+    }
 }
 static inline int cap_can_derive(cap_t p, cap_t c)
 {
-    if (cap_is_type(p, CAP_TYPE_MEMORY) && cap_is_type(c, CAP_TYPE_MEMORY))
+    uint64_t pt = cap_get_type(p), ct = cap_get_type(c);
+    if (pt >= NUM_OF_CAP_TYPES || ct >= NUM_OF_CAP_TYPES)
+        return 0;
+    switch (CAP_TYPE_PAIR(pt, ct)) {
+    case CAP_TYPE_PAIR(CAP_TYPE_MEMORY, CAP_TYPE_MEMORY):
         return (cap_memory_get_pmp(p) == 0) && (cap_memory_get_pmp(c) == 0) &&
                (cap_memory_get_free(p) == cap_memory_get_begin(c)) &&
                (cap_memory_get_end(c) <= cap_memory_get_end(p)) &&
                ((cap_memory_get_rwx(c) & cap_memory_get_rwx(p)) == cap_memory_get_rwx(c)) &&
                (cap_memory_get_free(c) == cap_memory_get_begin(c)) && (cap_memory_get_begin(c) < cap_memory_get_end(c));
-    if (cap_is_type(p, CAP_TYPE_MEMORY) && cap_is_type(c, CAP_TYPE_PMP))
+    case CAP_TYPE_PAIR(CAP_TYPE_MEMORY, CAP_TYPE_PMP):
         return (cap_memory_get_free(p) <= pmp_napot_begin(cap_pmp_get_addr(c))) &&
                (pmp_napot_end(cap_pmp_get_addr(c)) <= cap_memory_get_end(p)) &&
                ((cap_pmp_get_rwx(c) & cap_memory_get_rwx(p)) == cap_pmp_get_rwx(c));
-    if (cap_is_type(p, CAP_TYPE_TIME) && cap_is_type(c, CAP_TYPE_TIME))
+    case CAP_TYPE_PAIR(CAP_TYPE_TIME, CAP_TYPE_TIME):
         return (cap_time_get_free(p) == cap_time_get_begin(c)) && (cap_time_get_end(c) <= cap_time_get_end(p)) &&
                (cap_time_get_hartid(p) == cap_time_get_hartid(c)) && (cap_time_get_free(c) == cap_time_get_begin(c)) &&
                (cap_time_get_begin(c) < cap_time_get_end(c));
-    if (cap_is_type(p, CAP_TYPE_CHANNELS) && cap_is_type(c, CAP_TYPE_CHANNELS))
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_CHANNELS):
         return (cap_channels_get_free(p) == cap_channels_get_begin(c)) &&
                (cap_channels_get_end(c) <= cap_channels_get_end(p)) &&
                (cap_channels_get_free(c) == cap_channels_get_begin(c)) &&
                (cap_channels_get_begin(c) < cap_channels_get_end(c));
-    if (cap_is_type(p, CAP_TYPE_CHANNELS) && cap_is_type(c, CAP_TYPE_RECEIVER))
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_RECEIVER):
         return (cap_channels_get_free(p) == cap_receiver_get_channel(c)) &&
                (cap_receiver_get_channel(c) < cap_channels_get_end(p)) &&
                (cap_receiver_get_grant(c) == 0 || cap_receiver_get_grant(c) == 1);
-    if (cap_is_type(p, CAP_TYPE_RECEIVER) && cap_is_type(c, CAP_TYPE_SENDER))
+    case CAP_TYPE_PAIR(CAP_TYPE_RECEIVER, CAP_TYPE_SENDER):
         return (cap_receiver_get_channel(p) == cap_sender_get_channel(c)) &&
                (cap_receiver_get_grant(p) == cap_sender_get_grant(c));
-    if (cap_is_type(p, CAP_TYPE_CHANNELS) && cap_is_type(c, CAP_TYPE_SERVER))
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_SERVER):
         return (cap_channels_get_free(p) == cap_server_get_channel(c)) &&
                (cap_server_get_channel(c) < cap_channels_get_end(p)) &&
                (cap_server_get_grant(c) == 0 || cap_server_get_grant(c) == 1);
-    if (cap_is_type(p, CAP_TYPE_SERVER) && cap_is_type(c, CAP_TYPE_CLIENT))
+    case CAP_TYPE_PAIR(CAP_TYPE_SERVER, CAP_TYPE_CLIENT):
         return (cap_server_get_channel(p) == cap_client_get_channel(c)) &&
                (cap_server_get_grant(p) == cap_client_get_grant(c));
-    if (cap_is_type(p, CAP_TYPE_SUPERVISOR) && cap_is_type(c, CAP_TYPE_SUPERVISOR))
+    case CAP_TYPE_PAIR(CAP_TYPE_SUPERVISOR, CAP_TYPE_SUPERVISOR):
         return (cap_supervisor_get_free(p) <= cap_supervisor_get_begin(c)) &&
                (cap_supervisor_get_end(c) <= cap_supervisor_get_end(p)) &&
                (cap_supervisor_get_free(c) == cap_supervisor_get_begin(c)) &&
                (cap_supervisor_get_begin(c) < cap_supervisor_get_end(c));
-    return 0;
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_NOTIFICATION):
+        return (cap_channels_get_free(p) == cap_notification_get_channel(c)) &&
+               (cap_notification_get_channel(c) < cap_channels_get_end(p)) && (cap_notification_get_receive(c) == 1);
+    case CAP_TYPE_PAIR(CAP_TYPE_NOTIFICATION, CAP_TYPE_NOTIFICATION):
+        return (cap_notification_get_channel(p) == cap_notification_get_channel(c)) &&
+               (cap_notification_get_receive(p) == 1) && (cap_notification_get_receive(c) == 0);
+    case CAP_TYPE_PAIR(CAP_TYPE_CHANNELS, CAP_TYPE_MULTICAST):
+        return (cap_channels_get_begin(p) <= cap_multicast_get_begin(c)) &&
+               (cap_multicast_get_end(c) <= cap_channels_get_free(p)) &&
+               (cap_multicast_get_begin(c) < cap_multicast_get_end(c));
+    case CAP_TYPE_PAIR(CAP_TYPE_MULTICAST, CAP_TYPE_MULTICAST):
+        return (cap_multicast_get_begin(p) <= cap_multicast_get_begin(c)) &&
+               (cap_multicast_get_end(c) <= cap_multicast_get_end(p)) &&
+               (cap_multicast_get_begin(c) < cap_multicast_get_end(c));
+    default:
+        return 0;
+    }
 }
@@ -5,6 +5,8 @@ typedef enum proc_state proc_state_t;
 typedef enum s3k_error s3k_error_t;
 typedef enum s3k_call s3k_call_t;
 typedef enum s3k_call_sup s3k_call_sup_t;
+typedef enum s3k_send_flag s3k_send_flag_t;
+typedef enum s3k_batch_op s3k_batch_op_t;
 
 enum proc_state {
     PROC_STATE_READY,
@@ -43,6 +45,9 @@ enum s3k_call {
     ECALL_READ_REG,
     ECALL_WRITE_REG,
     ECALL_YIELD,
+    ECALL_CALL,
+    ECALL_REPLY_RECV,
+    ECALL_BATCH,
     NUM_OF_SYSNR
 };
 
@@ -55,4 +60,19 @@ enum s3k_call_sup {
     ECALL_SUP_READ_CAP,
     ECALL_SUP_GIVE_CAP,
     ECALL_SUP_TAKE_CAP,
+    ECALL_SUP_SAVE_MODE,
+    ECALL_SUP_LOAD_MODE,
+};
+
+enum s3k_batch_op {
+    BATCH_OP_DERIVE, /* src, dest, word0, word1 */
+    BATCH_OP_MOVE,   /* src, dest */
+    BATCH_OP_DELETE, /* cidx */
+    BATCH_OP_GIVE,   /* supervisor, pid, src, dest */
+    BATCH_OP_TAKE,   /* supervisor, pid, src, dest */
+};
+
+enum s3k_send_flag {
+    SEND_FLAG_NONBLOCK = 1, /* Fail with ERROR_NO_RECEIVER instead of parking */
+    SEND_FLAG_LATCH = 2,    /* Latch a wake-up instead of parking, see s3k_doorbell */
 };
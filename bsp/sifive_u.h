@@ -11,6 +11,8 @@
 /* Maximum hartid */
 #define MAX_HARTID 4
 
+#define N_HARTS (MAX_HARTID - MIN_HARTID + 1)
+
 /* Clint memory location */
 #define CLINT 0x2000000ull
 
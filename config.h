@@ -7,18 +7,56 @@
 /* Number of capabilities per process */
 #define N_CAPS 64
 
-/* Number of time slices in a major frame. */
+/* Number of time slices in a major frame, at most 65535. */
 #define N_QUANTUM 128
 
+/* Maximum number of slots (intervals of time slices) in the schedule. */
+/* Can be set lower than N_QUANTUM to save memory when N_QUANTUM is large, */
+/* deriving time capabilities then fails once their slots could overflow it. */
+#define N_SLOTS N_QUANTUM
+
 /* Number of communications channels */
 #define N_CHANNELS (N_PROC * (N_PROC - 1))
 
+/* Number of precomputed schedule modes. */
+#define N_SCHED_MODES 4
+
+/* Length of a major frame in microseconds. */
+#define MAJOR_FRAME_US 10000
+
 /* Number of ticks per quantum. */
 /* TICKS_PER_SECOND defined in platform.h */
-#define TICKS (TICKS_PER_SECOND / N_QUANTUM / 100)
+#define TICKS (TICKS_PER_SECOND * MAJOR_FRAME_US / 1000000 / N_QUANTUM)
+
+/* Time reserved at the end of each slot for the scheduler, in microseconds. */
+/* Must be shorter than a quantum on every platform, see TICKS. */
+#define SCHEDULER_US 20
+
+/* Number of scheduler ticks, used until the scheduler is calibrated. */
+#define SCHEDULER_TICKS (TICKS_PER_SECOND * SCHEDULER_US / 1000000)
+
+/* Measure the first dispatches from the expired timeout and set the scheduler ticks from them. */
+/* Comment out to always use SCHEDULER_TICKS. */
+#define SCHEDULER_CALIBRATE
+
+/* Number of dispatches measured before the scheduler ticks are set. */
+#define CALIBRATION_ROUNDS 64
+
+/* Time added to the measured dispatch for the trap exit (register restore and mret), which */
+/* is not measured, in microseconds. One tick more covers the rounding of the measurement. */
+#define SCHEDULER_GUARD_US 2
+#define SCHEDULER_GUARD_TICKS (TICKS_PER_SECOND * SCHEDULER_GUARD_US / 1000000 + 1)
+
+/* Uncomment to keep measuring after the calibration and raise the scheduler ticks if needed */
+/* Requires SCHEDULER_CALIBRATE. */
+//#define SCHEDULER_TRACK
+
+/* Uncomment to serve processes waiting on a channel by lowest pid instead of arrival order */
+//#define WAITQ_PRIORITY
 
-/* Number of scheduler ticks. */
-#define SCHEDULER_TICKS 2000
+/* Number of words copied at most between IPC buffers in one send, call or reply. */
+/* At most 1023, the smallest pmp region is 8 KiB. */
+#define N_IPC_WORDS 64
 
 /* Uncomment to enable memory protection */
 //#define MEMORY_PROTECTION
@@ -57,6 +57,11 @@ void foo(void)
     DEFINE_OFFSET(PROC_STATE, proc_t, state);
     DEFINE_OFFSET(PROC_CAP_TABLE, proc_t, cap_table);
     DEFINE_OFFSET(PROC_CLIENT, proc_t, client);
+#ifdef __riscv_flen
+    DEFINE_OFFSET(PROC_FPU, proc_t, fpu);
+    DEFINE_OFFSET(FPU_FCSR, fpu_regs_t, fcsr);
+    DEFINE_OFFSET(FPU_HARTID, fpu_regs_t, hartid);
+#endif
 
     DEFINE_OFFSET(CAP_NODE_PREV, cap_node_t, prev);
     DEFINE_OFFSET(CAP_NODE_NEXT, cap_node_t, next);
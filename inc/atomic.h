@@ -7,6 +7,7 @@
 #define fetch_and_and(ptr, val) __sync_fetch_and_and(ptr, val)
 #define fetch_and_or(ptr, val) __sync_fetch_and_or(ptr, val)
 #define fetch_and_add(ptr, val) __sync_fetch_and_add(ptr, val)
+#define fetch_and_set(ptr, val) __sync_lock_test_and_set(ptr, val)
 
 #ifndef BUILTIN_ATOMIC
 // the builtin atomic compare_and_swap/set always uses registers a0 and a1 as temporary registers,
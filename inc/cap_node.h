@@ -15,13 +15,36 @@ typedef struct cap_node cap_node_t;
 struct cap_node {
     cap_node_t *prev, *next;
     cap_t cap;
+    /* Derivation stamp, larger than the stamps of the node's ancestors */
+    uint64_t stamp;
+    /* Fence generation in which the node was last found outside every fence */
+    uint64_t gen;
 };
 
 extern cap_node_t cap_tables[N_PROC][N_CAPS];
+/* Node each process is revoking, or NULL, see cap_node_is_revoked */
+extern cap_node_t* volatile cap_revoking[N_PROC];
+/* Number of revokes in progress */
+extern volatile uint64_t cap_revokes;
+/* Fence generation, incremented when a revoke begins, starts at 1 */
+extern volatile uint64_t cap_fence_gen;
+/* Last derivation stamp */
+extern uint64_t cap_stamp;
 
 static inline bool cap_node_is_deleted(cap_node_t* cn);
+static inline bool cap_node_is_revoked(cap_node_t* cn, cap_t cap);
 static inline cap_t cap_node_get_cap(cap_node_t* cn);
 
+/*
+ * Revoke the subtree of node at once, its nodes read as deleted until they
+ * are. The fence is only ended by cap_node_revoke_end once the walk of the
+ * revoke has deleted them, if pid may never finish the walk, its
+ * supervisor finishes it.
+ */
+static inline void cap_node_revoke_begin(cap_node_t* node, uint64_t pid);
+/* End the fence of pid on node, if it is still open */
+static inline void cap_node_revoke_end(cap_node_t* node, uint64_t pid);
+
 /* Delete node */
 static inline bool cap_node_delete(cap_node_t* node);
 /* Delete node iff node->prev == prev */
@@ -29,6 +52,8 @@ static inline bool cap_node_delete2(cap_node_t* node, cap_node_t* prev);
 /* Insert node after parent, if insertion is successful, set the data to cap */
 static inline bool cap_node_insert(cap_t cap, cap_node_t* node, cap_node_t* parent);
 static inline bool cap_node_move(cap_t cap, cap_node_t* src_node, cap_node_t* dest_node);
+/* Insert node after prev without setting its stamp */
+static inline bool cap_node_link(cap_t cap, cap_node_t* node, cap_node_t* prev);
 
 /* Check if a node has been deleted */
 bool cap_node_is_deleted(cap_node_t* cn)
@@ -36,15 +61,59 @@ bool cap_node_is_deleted(cap_node_t* cn)
     return cn->prev == NULL;
 }
 
+/*
+ * Check if a revoke in progress covers the node. Resources are partitioned
+ * by the derivation tree, so a child of the revoked capability derived after
+ * it is one of its descendants. Fences only end once their nodes are
+ * deleted, so a node found outside every fence stays so until the next
+ * fence begins, and is only checked against the fences once per generation.
+ */
+bool cap_node_is_revoked(cap_node_t* cn, cap_t cap)
+{
+    if (cap_revokes == 0)
+        return false;
+    uint64_t gen = cap_fence_gen;
+    if (cn->gen == gen)
+        return false;
+    __sync_synchronize();
+    for (int i = 0; i < N_PROC; i++) {
+        cap_node_t* revoked = cap_revoking[i];
+        if (revoked != NULL && cn->stamp > revoked->stamp && cap_is_child(revoked->cap, cap))
+            return true;
+    }
+    cn->gen = gen;
+    return false;
+}
+
 cap_t cap_node_get_cap(cap_node_t* cn)
 {
     cap_t cap = cn->cap;
     __sync_synchronize();
-    if (cap_node_is_deleted(cn))
+    if (cap_node_is_deleted(cn) || cap_node_is_revoked(cn, cap))
         return NULL_CAP;
     return cap;
 }
 
+void cap_node_revoke_begin(cap_node_t* node, uint64_t pid)
+{
+    /* Called again when a preempted revoke resumes, the fence is still open */
+    if (compare_and_set(&cap_revoking[pid], NULL, node)) {
+        fetch_and_add(&cap_revokes, 1);
+        /* The fence is visible before the generation, so no node is cached outside it */
+        __sync_synchronize();
+        fetch_and_add(&cap_fence_gen, 1);
+    }
+    kassert(cap_revoking[pid] == node);
+    __sync_synchronize();
+}
+
+void cap_node_revoke_end(cap_node_t* node, uint64_t pid)
+{
+    /* The walk may be finished by both pid and its supervisor */
+    if (compare_and_set(&cap_revoking[pid], node, NULL))
+        fetch_and_add(&cap_revokes, -1);
+}
+
 bool cap_node_delete(cap_node_t* node)
 {
     cap_node_t* prev;
@@ -73,9 +142,17 @@ bool cap_node_delete2(cap_node_t* node, cap_node_t* prev)
  * only if the parent is not deleted.
  */
 bool cap_node_insert(cap_t cap, cap_node_t* node, cap_node_t* prev)
+{
+    node->stamp = fetch_and_add(&cap_stamp, 1) + 1;
+    return cap_node_link(cap, node, prev);
+}
+
+bool cap_node_link(cap_t cap, cap_node_t* node, cap_node_t* prev)
 {
     kassert(node->prev == NULL);
     node->cap = cap;
+    /* The node may have been found outside the fences in an earlier use */
+    node->gen = 0;
     cap_node_t* next = prev->next;
     while (prev->prev != NULL) {
         node->next = next;
@@ -91,5 +168,7 @@ bool cap_node_insert(cap_t cap, cap_node_t* node, cap_node_t* prev)
 
 bool cap_node_move(cap_t cap, cap_node_t* src_node, cap_node_t* dest_node)
 {
-    return cap_node_insert(cap, dest_node, src_node) && cap_node_delete(src_node);
+    /* The moved node keeps its place in the derivation order */
+    dest_node->stamp = src_node->stamp;
+    return cap_node_link(cap, dest_node, src_node) && cap_node_delete(src_node);
 }
@@ -20,3 +20,5 @@
 #define set_csr(reg, in) ({ __asm__ volatile("csrs " #reg ",%0" ::"r"(in)); })
 
 #define clear_csr(reg, in) ({ __asm__ volatile("csrc " #reg ",%0" ::"r"(in)); })
+
+#define wfi() __asm__ volatile("wfi")
@@ -0,0 +1,18 @@
+// See LICENSE file for copyright and license details.
+#pragma once
+#ifdef __riscv_flen
+#include "proc.h"
+
+/* mstatus.FS, floating-point unit state */
+#define MSTATUS_FS 0x6000ull
+#define MSTATUS_FS_OFF 0x0000ull
+#define MSTATUS_FS_CLEAN 0x4000ull
+
+/* fpu.hartid of a process whose registers are only in memory */
+#define FPU_NO_HART (-1ull)
+
+void fpu_init(proc_t* proc);
+void fpu_load(proc_t* proc);
+/* Load the registers from fpu, defined in fpu.S */
+void fpu_load_regs(fpu_regs_t* fpu);
+#endif
@@ -12,6 +12,9 @@
 
 typedef struct regs regs_t;
 typedef struct proc proc_t;
+#ifdef __riscv_flen
+typedef struct fpu_regs fpu_regs_t;
+#endif
 
 struct regs {
     /* Standard registers */
@@ -31,8 +34,20 @@ struct regs {
     /* Exception handling registers */
     uint64_t tpc, tsp, cause, tval;
     uint64_t ppc, psp, pa0, pa1;
+    /* IPC buffer, slot of a pmp capability, none if >= N_CAPS */
+    uint64_t ipc_cidx;
 };
 
+#ifdef __riscv_flen
+/* Floating-point registers, switched lazily, see fpu.c */
+struct fpu_regs {
+    uint64_t f[32];
+    uint64_t fcsr;
+    /* Hart with the registers loaded, or FPU_NO_HART */
+    uint64_t hartid;
+};
+#endif
+
 struct proc {
     regs_t regs;
     uint64_t pid;
@@ -40,10 +55,20 @@ struct proc {
     uint64_t dest_cidx;
     cap_node_t* cap_table;
     proc_t* client;
+    /* Arrival order in the channel wait queue, see waitq.c */
+    uint64_t ticket;
+#ifdef __riscv_flen
+    fpu_regs_t fpu;
+#endif
 };
 
 extern proc_t processes[N_PROC];
+#ifdef __riscv
 register proc_t* current __asm__("tp");
+#else
+/* Host builds of kernel sources, see sim/ */
+extern proc_t* current;
+#endif
 
 void proc_init(uint64_t root_payload);
 void proc_load_pmp(proc_t* proc);
@@ -52,6 +77,8 @@ static inline cap_node_t* proc_get_cap_node(proc_t* proc, uint64_t cid);
 static inline cap_t proc_get_cap(proc_t* proc, uint64_t cid);
 static inline uint64_t proc_read_register(proc_t* proc, uint64_t regi);
 static inline uint64_t proc_write_register(proc_t* proc, uint64_t regi, uint64_t regv);
+static inline uint64_t* proc_get_ipc_buffer(proc_t* proc, uint64_t rwx);
+static inline bool proc_has_access(proc_t* proc, uint64_t begin, uint64_t end, uint64_t rwx);
 
 cap_node_t* proc_get_cap_node(proc_t* proc, uint64_t cid)
 {
@@ -82,3 +109,28 @@ uint64_t proc_write_register(proc_t* proc, uint64_t regi, uint64_t regv)
     }
     return 0;
 }
+
+/* Returns the IPC buffer if its pmp capability grants rwx, else NULL */
+uint64_t* proc_get_ipc_buffer(proc_t* proc, uint64_t rwx)
+{
+    if (proc->regs.ipc_cidx >= N_CAPS)
+        return NULL;
+    cap_t cap = proc_get_cap(proc, proc->regs.ipc_cidx);
+    if (!cap_is_type(cap, CAP_TYPE_PMP) || (cap_pmp_get_rwx(cap) & rwx) != rwx)
+        return NULL;
+    return (uint64_t*)(pmp_napot_begin(cap_pmp_get_addr(cap)) << 12);
+}
+
+/* Returns true if a loaded pmp capability grants rwx on [begin, end) */
+bool proc_has_access(proc_t* proc, uint64_t begin, uint64_t end, uint64_t rwx)
+{
+    for (int i = 0; i < 8; i++) {
+        cap_t cap = proc_get_cap(proc, i);
+        if (!cap_is_type(cap, CAP_TYPE_PMP) || (cap_pmp_get_rwx(cap) & rwx) != rwx)
+            continue;
+        uint64_t addr = cap_pmp_get_addr(cap);
+        if ((pmp_napot_begin(addr) << 12) <= begin && end <= ((pmp_napot_end(addr) + 1) << 12))
+            return true;
+    }
+    return false;
+}
@@ -11,11 +11,18 @@ static inline void proc_supervisor_release(proc_t* proc);
 static inline bool proc_supervisor_resume(proc_t* proc);
 static inline bool proc_supervisor_suspend(proc_t* proc);
 static inline bool proc_receiver_wait(proc_t* proc, uint64_t channel);
+static inline bool proc_receiver_cancel(proc_t* proc, uint64_t channel);
 static inline bool proc_sender_acquire(proc_t* proc, uint64_t channel);
 static inline void proc_sender_release(proc_t* proc);
+static inline void proc_sender_unacquire(proc_t* proc, uint64_t channel);
+static inline bool proc_sender_switch(proc_t* proc, uint64_t channel);
 static inline bool proc_server_acquire(proc_t* proc, uint64_t channel);
 static inline void proc_server_release(proc_t* proc);
 static inline bool proc_client_wait(proc_t* proc, uint64_t channel);
+static inline bool proc_sender_wait(proc_t* proc, uint64_t channel);
+static inline bool proc_sender_cancel(proc_t* proc, uint64_t channel);
+static inline bool proc_caller_take(proc_t* proc, uint64_t channel);
+static inline bool proc_caller_acquire(proc_t* proc, uint64_t channel);
 
 void proc_release(proc_t* proc)
 {
@@ -74,6 +81,13 @@ bool proc_receiver_wait(proc_t* proc, uint64_t channel)
     return compare_and_set(&current->state, expected, desired);
 }
 
+/* Stop waiting before any sender acquired the process, fails if one did */
+bool proc_receiver_cancel(proc_t* proc, uint64_t channel)
+{
+    uint64_t expected = channel << 48 | PROC_STATE_WAITING;
+    return compare_and_set(&proc->state, expected, PROC_STATE_RUNNING);
+}
+
 bool proc_sender_acquire(proc_t* proc, uint64_t channel)
 {
     uint64_t expected = channel << 48 | PROC_STATE_WAITING;
@@ -88,11 +102,59 @@ bool proc_client_wait(proc_t* proc, uint64_t channel)
     return compare_and_set(&current->state, expected, desired);
 }
 
+/* Park a blocking sender on channel until a receiver takes its message */
+bool proc_sender_wait(proc_t* proc, uint64_t channel)
+{
+    uint64_t expected = PROC_STATE_RUNNING;
+    uint64_t desired = channel << 48 | PROC_STATE_WAITING | (1ull << (__riscv_xlen - 1));
+    return compare_and_set(&current->state, expected, desired);
+}
+
+/* Unpark a sender that delivers itself, fails if a receiver took its message */
+bool proc_sender_cancel(proc_t* proc, uint64_t channel)
+{
+    uint64_t expected = channel << 48 | PROC_STATE_WAITING | (1ull << (__riscv_xlen - 1));
+    return compare_and_set(&proc->state, expected, PROC_STATE_RUNNING);
+}
+
+/* Take the message of a client queued by proc_client_wait, it keeps waiting for the reply */
+bool proc_caller_take(proc_t* proc, uint64_t channel)
+{
+    uint64_t expected = channel << 48 | PROC_STATE_WAITING | (1ull << (__riscv_xlen - 1));
+    uint64_t desired = channel << 48 | PROC_STATE_WAITING;
+    return compare_and_set(&proc->state, expected, desired);
+}
+
+/* Acquire a queued client or parked sender, release with proc_sender_release */
+bool proc_caller_acquire(proc_t* proc, uint64_t channel)
+{
+    uint64_t expected = channel << 48 | PROC_STATE_WAITING | (1ull << (__riscv_xlen - 1));
+    uint64_t desired = channel << 48 | PROC_STATE_RECEIVING;
+    return compare_and_set(&proc->state, expected, desired);
+}
+
 void proc_sender_release(proc_t* proc)
 {
     fetch_and_and(&proc->state, PROC_STATE_SUSPENDED);
 }
 
+/* Return a process acquired by proc_sender_acquire to waiting, without a message */
+void proc_sender_unacquire(proc_t* proc, uint64_t channel)
+{
+    uint64_t expected = channel << 48 | PROC_STATE_RECEIVING;
+    uint64_t desired = channel << 48 | PROC_STATE_WAITING;
+    /* Suspended meanwhile, the release completes the suspend */
+    if (!compare_and_set(&proc->state, expected, desired))
+        proc_sender_release(proc);
+}
+
+/* Hand a process acquired by a sender straight to running, fails if it was suspended meanwhile */
+bool proc_sender_switch(proc_t* proc, uint64_t channel)
+{
+    uint64_t expected = channel << 48 | PROC_STATE_RECEIVING;
+    return compare_and_set(&proc->state, expected, PROC_STATE_RUNNING);
+}
+
 bool proc_server_acquire(proc_t* proc, uint64_t channel)
 {
     uint64_t expected = channel << 48 | PROC_STATE_WAITING;
@@ -11,6 +11,20 @@
 #define INVALID_PID 0xFFull
 
 void sched_init(void);
+uint64_t sched_get_scheduler_ticks(void);
+uint64_t sched_get_measured_ticks(void);
 void sched_yield(void) __attribute__((noreturn));
 void sched_start(void) __attribute__((noreturn));
+void sched_donate(proc_t* proc) __attribute__((noreturn));
+/* Check if hartid runs a slot of proc that has not ended */
+bool sched_owns_slot(uint64_t hartid, proc_t* proc);
 void sched_update(cap_node_t* cn, uint64_t hartid, uint64_t begin, uint64_t end, uint64_t pid);
+/* Reserve the slots of a new time capability on hartid, fails if there is no room */
+bool sched_reserve(uint64_t hartid);
+void sched_unreserve(uint64_t hartid);
+bool sched_save_mode(uint64_t mode);
+bool sched_load_mode(uint64_t mode);
+/* Run pid in the slots the owner of cn yields on hartid, none if pid >= N_PROC */
+void sched_set_background(cap_node_t* cn, uint64_t hartid, uint64_t pid);
+/* Drop the background processes set with cn, on every hart */
+void sched_clear_background(cap_node_t* cn);
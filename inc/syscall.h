@@ -1,5 +1,6 @@
 // See LICENSE file for copyright and license details.
 #pragma once
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "cap_node.h"
@@ -9,8 +10,23 @@ uint64_t syscall_move_cap(uint64_t src_cidx, uint64_t dest_cidx);
 uint64_t syscall_delete_cap(uint64_t cidx);
 uint64_t syscall_revoke_cap(uint64_t cidx);
 uint64_t syscall_derive_cap(uint64_t src_cidx, uint64_t dest_cidx, uint64_t word0, uint64_t word1);
+uint64_t syscall_batch(uint64_t ops, uint64_t n);
 
 uint64_t syscall_get_pid(void);
 uint64_t syscall_read_reg(uint64_t regnr);
 uint64_t syscall_write_reg(uint64_t regnr, uint64_t val);
 void syscall_yield(void);
+uint64_t syscall_call(uint64_t cidx, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t no_cidx,
+                      uint64_t donate, uint64_t len);
+uint64_t syscall_reply_recv(uint64_t cidx, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t len);
+
+/* Fast handlers, called with only caller-saved registers saved. Write the
+ * results to current->regs and return true, or return false to fall back
+ * to the handler above. Must not block, yield or access s0-s11 in regs. */
+bool syscall_fast_read_cap(uint64_t cidx);
+bool syscall_fast_invoke_cap(uint64_t cidx, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5,
+                             uint64_t arg6, uint64_t arg7);
+bool syscall_fast_get_pid(void);
+bool syscall_fast_read_reg(uint64_t regnr);
+bool syscall_fast_write_reg(uint64_t regnr, uint64_t val);
+bool syscall_fast_reply_recv(uint64_t cidx, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t len);
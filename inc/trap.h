@@ -1,4 +1,5 @@
 // See LICENSE file for copyright and license details.
 #pragma once
+void trap_vector(void) __attribute__((noreturn));
 void trap_entry(void) __attribute__((noreturn));
 void trap_resume_proc(void) __attribute__((noreturn));
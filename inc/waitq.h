@@ -0,0 +1,17 @@
+// See LICENSE file for copyright and license details.
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "proc.h"
+
+/*
+ * Per-channel queues of processes waiting to send on or call a channel.
+ * Lock-free, any hart may push and the channel's receiver or server pops.
+ * A process is queued at most once per channel, so a queue holds at most
+ * N_PROC processes. Popped processes may no longer be waiting, the caller
+ * must check their state.
+ */
+void waitq_push(uint64_t channel, proc_t* proc);
+proc_t* waitq_pop(uint64_t channel);
+bool waitq_is_empty(uint64_t channel);
@@ -136,23 +136,179 @@ def make_pred_case(case):
     parent_type = f"CAP_TYPE_{case['parent'].upper()}"
     child_type = f"CAP_TYPE_{case['child'].upper()}"
     make_translator(case)
-    print(f"if (cap_is_type(p,{parent_type}) && cap_is_type(c, {child_type}))")
+    print(f"case CAP_TYPE_PAIR({parent_type}, {child_type}):")
     print(f"return {'&&'.join(case['conditions'])};")
 
 def make_pred(p):
+    # Switch over the (parent, child) type pair, compiled to a jump table
     name=p['name']
     print(f"static inline int cap_{name}(cap_t p, cap_t c) {{")
+    print("uint64_t pt = cap_get_type(p), ct = cap_get_type(c);")
+    print("if (pt >= NUM_OF_CAP_TYPES || ct >= NUM_OF_CAP_TYPES)")
+    print("return 0;")
+    print("switch (CAP_TYPE_PAIR(pt, ct)) {")
     for case in p['cases']:
         make_pred_case(case)
+    print("default:")
+    print("return 0;")
+    print("}")
+    print("}")
+
+def make_chain_pred(p):
+    # Chain of type tests, the form the switch replaced
+    name=p['name']
+    print(f"static int cap_{name}_chain(cap_t p, cap_t c) {{")
+    for case in p['cases']:
+        parent_type = f"CAP_TYPE_{case['parent'].upper()}"
+        child_type = f"CAP_TYPE_{case['child'].upper()}"
+        make_translator(case)
+        print(f"if (cap_is_type(p,{parent_type}) && cap_is_type(c, {child_type}))")
+        print(f"return {'&&'.join(case['conditions'])};")
+    print("return 0;")
+    print("}")
+
+def make_bench(data):
+    preds = data['predicates']
+    print("""\
+/* Generated by scripts/cap_gen.py --bench, checks and times the predicates of gen/cap.h */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "gen/cap.h"
+
+#define N_PAIRS 4096
+#define ROUNDS 64
+
+int kprintf(const char* format, ...)
+{
+va_list args;
+va_start(args, format);
+int n = vfprintf(stderr, format, args);
+va_end(args);
+return n;
+}
+
+void hang(void)
+{
+exit(2);
+}
+
+static uint64_t now(void)
+{
+struct timespec ts;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t seed = 88172645463325252ull;
+
+static uint64_t rnd(void)
+{
+seed ^= seed << 13;
+seed ^= seed >> 7;
+seed ^= seed << 17;
+return seed;
+}
+
+/* Small field values, so that the relations hold about as often as not */
+static cap_t rnd_cap(void)
+{
+cap_t cap = NULL_CAP;
+for (int i = 0; i < 64; i += 8) {
+cap.word0 |= (rnd() & 0x3ull) << i;
+cap.word1 |= (rnd() & 0x3ull) << i;
+}
+cap.word0 = (cap.word0 & ~0xffull) | (rnd() % (NUM_OF_CAP_TYPES + 1));
+return cap;
+}
+
+static cap_t parents[N_PAIRS], children[N_PAIRS];
+""")
+    pairs = sorted({(c['parent'], c['child']) for p in preds for c in p['cases']})
+    print("/* Type pairs with a case in some predicate */")
+    print("static const cap_type_t cases[][2] = {")
+    for (pp, cc) in pairs:
+        print(f"{{CAP_TYPE_{pp.upper()}, CAP_TYPE_{cc.upper()}}},")
+    print("};")
+
+    for p in preds:
+        make_chain_pred(p)
+    print("""
+/* Best time of ROUNDS over the pairs, in picoseconds per call */
+#define TIME(pred, n, sum)                                  \\
+({                                                          \\
+uint64_t _best = -1;                                        \\
+for (int _r = 0; _r < ROUNDS; _r++) {                       \\
+uint64_t _t0 = now();                                       \\
+for (int _i = 0; _i < n; _i++)                              \\
+sum += pred(parents[_i], children[_i]);                     \\
+uint64_t _t = now() - _t0;                                  \\
+_best = _t < _best ? _t : _best;                            \\
+}                                                           \\
+_best * 1000 / n;                                           \\
+})
+
+int main(void)
+{
+volatile uint64_t sum = 0;
+uint64_t holds = 0, n = 0;
+for (int i = 0; i < N_PAIRS; i++) {
+parents[i] = rnd_cap();
+children[i] = rnd_cap();
+}
+/* Random pairs, compared field by field with the chain */
+for (int i = 0; i < 1 << 20; i++) {
+cap_t p = rnd_cap(), c = rnd_cap();
+/* Every other pair has a case, the rest are mostly without */
+if (i & 1) {
+int j = rnd() % (sizeof(cases) / sizeof(cases[0]));
+p.word0 = (p.word0 & ~0xffull) | cases[j][0];
+c.word0 = (c.word0 & ~0xffull) | cases[j][1];
+}""")
+    for p in preds:
+        name = p['name']
+        print(f"""if (cap_{name}(p, c) != cap_{name}_chain(p, c)) {{
+printf("cap_{name} differs for %llx:%llx %llx:%llx\\n", p.word0, p.word1, c.word0, c.word1);
+return 1;
+}}
+holds += cap_{name}(p, c);
+n++;""")
+    print("}")
+    print('printf("%lu pairs equal, predicate holds for %lu\\n", n, holds);')
+    print('printf("%-36s %10s %10s\\n", "ps per call", "switch", "chain");')
+    for p in preds:
+        name = p['name']
+        last = p['cases'][-1]
+        print(f'printf("%-36s %10lu ", "{name}", TIME(cap_{name}, N_PAIRS, sum));')
+        print(f'printf("%10lu\\n", TIME(cap_{name}_chain, N_PAIRS, sum));')
+        # The last case pays for every test of the chain
+        print("for (int i = 0; i < N_PAIRS; i++) {")
+        print(f"parents[i].word0 = (parents[i].word0 & ~0xffull) | CAP_TYPE_{last['parent'].upper()};")
+        print(f"children[i].word0 = (children[i].word0 & ~0xffull) | CAP_TYPE_{last['child'].upper()};")
+        print("}")
+        label = f"{name} ({last['parent']}, {last['child']})"
+        print(f'printf("%-36s %10lu ", "{label}", TIME(cap_{name}, N_PAIRS, sum));')
+        print(f'printf("%10lu\\n", TIME(cap_{name}_chain, N_PAIRS, sum));')
+        print("for (int i = 0; i < N_PAIRS; i++) {")
+        print("parents[i] = rnd_cap();")
+        print("children[i] = rnd_cap();")
+        print("}")
     print("return 0;")
     print("}")
-    
 
 # Open the file and load the file
 
-with open(sys.argv[1]) as f:
+# cap_gen.py <cap.yml> writes gen/cap.h, cap_gen.py --bench <cap.yml> a benchmark of its predicates
+bench = sys.argv[1] == '--bench'
+with open(sys.argv[-1]) as f:
     data = yaml.load(f, Loader=SafeLoader)
 
+if bench:
+    make_bench(data)
+    sys.exit(0)
+
 caps = data['caps']
 enums = ", ".join([f"CAP_TYPE_{d['name'].upper()}"  for d in caps])
 
@@ -162,6 +318,7 @@ print(f"""\
 #include <stdint.h>
 
 #define NULL_CAP ((cap_t){{0,0}})
+#define CAP_TYPE_PAIR(p, c) ((p) * NUM_OF_CAP_TYPES + (c))
 
 typedef enum cap_type cap_type_t;
 typedef struct cap cap_t;
@@ -0,0 +1,15 @@
+// See LICENSE file for copyright and license details.
+/* Host replacement of inc/csr.h for the simulator, there are no CSRs. */
+#pragma once
+
+/* The simulator runs as the first hart, with the timer interrupt pending */
+#define read_csr(reg) sim_csr_##reg
+#define sim_csr_mhartid ((unsigned long)MIN_HARTID)
+#define sim_csr_mcycle 0ul
+#define sim_csr_mip 128ul
+
+#define write_csr(reg, _in) ((void)(_in))
+#define swap_csr(reg, in) ((void)(in), 0ul)
+#define set_csr(reg, in) ((void)(in))
+#define clear_csr(reg, in) ((void)(in))
+#define wfi()
@@ -0,0 +1,401 @@
+// See LICENSE file for copyright and license details.
+/*
+ * Host-side IPC race check.
+ *
+ * Runs the kernel's channel system calls (src/syscall.c) for several
+ * processes on one host thread and interleaves them at a chosen point, as
+ * if the processes ran on different harts. Each scenario checks the states
+ * and registers of the processes afterwards.
+ *     client   A server is busy, a client queues, the server finishes and
+ *              serves it before the client checks the server again.
+ *     sender   A receiver is busy, a blocking sender parks, the receiver takes
+ *              the message and waits again before the sender checks it.
+ *     call     A server is busy, s3k_call queues with a capability index left in
+ *              a5, the server takes the call without taking the capability.
+ *     donate   A client donates its slot to a server, which gives it back with
+ *              the reply, but not once the slot has ended.
+ *     revoke   A server is busy with a client queued, the channel capability
+ *              is revoked and the queued client is rejected.
+ *     park     A receiver is busy with a sender parked, the channel capability
+ *              is revoked and the parked sender is woken with an error.
+ *     multicast A server and a receiver wait in the range of a multicast, only
+ *              the receiver gets the message.
+ * Exits with 1 and names the failed check if a scenario fails.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "atomic.h"
+#include "preemption.h"
+
+/* There are no interrupts on the host */
+#define preemption_enable() ((void)0)
+#define preemption_disable() ((void)0)
+/* The interleaved process runs at the first barrier after it is armed */
+static void sim_barrier(void);
+#undef synchronize
+#define synchronize() sim_barrier()
+
+#include "cap_node.c"
+#include "syscall.c"
+#include "waitq.c"
+
+#define MAX_DEPTH 4
+#define CHANNEL 0ull
+
+/* Stand-ins for kernel symbols used by syscall.c */
+proc_t processes[N_PROC];
+proc_t* current;
+static cap_node_t sentinel;
+
+/* Where sched_yield returns to, one per process running */
+static jmp_buf yields[MAX_DEPTH];
+static int depth;
+/* Runs the other "hart" at the next barrier with a process queued on CHANNEL */
+static void (*interleave)(void);
+static const char* scenario;
+/* Owner of the running slot, and the last process donated to */
+static uint64_t slot_owner;
+static proc_t* donated;
+
+int kprintf(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vfprintf(stderr, format, args);
+    va_end(args);
+    return n;
+}
+
+void hang(void)
+{
+    exit(2);
+}
+
+void sched_yield(void)
+{
+    proc_release(current);
+    longjmp(yields[depth - 1], 1);
+}
+
+void sched_donate(proc_t* proc)
+{
+    donated = proc;
+    sched_yield();
+}
+
+bool sched_owns_slot(uint64_t hartid, proc_t* proc)
+{
+    return proc->pid == slot_owner;
+}
+
+void sched_update(cap_node_t* cn, uint64_t hartid, uint64_t begin, uint64_t end, uint64_t pid)
+{
+}
+
+bool sched_reserve(uint64_t hartid)
+{
+    return true;
+}
+
+void sched_unreserve(uint64_t hartid)
+{
+}
+
+void sched_set_background(cap_node_t* cn, uint64_t hartid, uint64_t pid)
+{
+}
+
+void sched_clear_background(cap_node_t* cn)
+{
+}
+
+bool sched_save_mode(uint64_t mode)
+{
+    return false;
+}
+
+bool sched_load_mode(uint64_t mode)
+{
+    return false;
+}
+
+void sim_barrier(void)
+{
+    __sync_synchronize();
+    if (interleave != NULL && !waitq_is_empty(CHANNEL)) {
+        void (*f)(void) = interleave;
+        interleave = NULL;
+        f();
+    }
+}
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        printf("%s: %s\n", scenario, what);
+        exit(1);
+    }
+}
+
+/* Dispatch proc and run the invocation of cap with message msg, until it returns or yields */
+static void run(proc_t* proc, cap_t cap, uint64_t msg, uint64_t flags)
+{
+    proc_t* prev = current;
+    kassert(depth < MAX_DEPTH);
+    proc->state = PROC_STATE_RUNNING;
+    /* The trap saved the message in the registers */
+    proc->regs.a1 = msg;
+    current = proc;
+    if (setjmp(yields[depth++]) == 0) {
+        uint64_t code;
+        switch (cap_get_type(cap)) {
+        case CAP_TYPE_SERVER:
+            code = syscall_invoke_server(cap, msg, 0, 0, 0, N_CAPS, flags, 0);
+            break;
+        case CAP_TYPE_RECEIVER:
+            code = syscall_invoke_receiver(cap, msg, 0, 0, 0);
+            break;
+        case CAP_TYPE_SENDER:
+            code = syscall_invoke_sender(cap, msg, 0, 0, 0, N_CAPS, flags, 0);
+            break;
+        case CAP_TYPE_CLIENT:
+            code = syscall_invoke_client(cap, msg, 0, 0, 0, N_CAPS, flags, 0);
+            break;
+        default:
+            code = ERROR_UNIMPLEMENTED;
+        }
+        /* Returned without yielding, the process keeps running */
+        proc->regs.a0 = code;
+    }
+    depth--;
+    current = prev;
+}
+
+/* As run, but through the call system call with client capability cidx */
+static void run_call(proc_t* proc, uint64_t cidx, uint64_t msg)
+{
+    proc_t* prev = current;
+    kassert(depth < MAX_DEPTH);
+    proc->state = PROC_STATE_RUNNING;
+    proc->regs.a1 = msg;
+    current = proc;
+    if (setjmp(yields[depth++]) == 0)
+        proc->regs.a0 = syscall_call(cidx, msg, 0, 0, 0, proc->regs.a5, false, 0);
+    depth--;
+    current = prev;
+}
+
+static void reset(const char* name)
+{
+    scenario = name;
+    sentinel.prev = &sentinel;
+    sentinel.next = &sentinel;
+    for (uint64_t pid = 0; pid < N_PROC; pid++) {
+        processes[pid] = (proc_t){0};
+        processes[pid].pid = pid;
+        processes[pid].cap_table = cap_tables[pid];
+        for (uint64_t i = 0; i < N_CAPS; i++)
+            cap_tables[pid][i] = (cap_node_t){0};
+        processes[pid].regs.dest_cidx = -1;
+        processes[pid].regs.ipc_cidx = -1;
+        processes[pid].state = PROC_STATE_SUSPENDED;
+    }
+    receivers[CHANNEL][0] = &processes[0];
+    receivers[CHANNEL][1] = NULL;
+}
+
+/* Server pid 0 replies to pid 1 and takes the call of pid 2, then replies to it and waits */
+static void client_server_finishes(void)
+{
+    cap_t server = cap_mk_server(CHANNEL, 0);
+    run(&processes[0], server, 101, true);
+    check(processes[0].regs.a1 == 12, "server did not take the queued call");
+    run(&processes[0], server, 102, true);
+}
+
+static void client_race(void)
+{
+    cap_t server = cap_mk_server(CHANNEL, 0);
+    cap_t client = cap_mk_client(CHANNEL, 0);
+    reset("client");
+    /* Server waits, pid 1 calls, server is busy with it */
+    run(&processes[0], server, 0, true);
+    run(&processes[1], client, 11, false);
+    check(processes[0].regs.a1 == 11, "server did not get the first call");
+    processes[0].state = PROC_STATE_RUNNING;
+    /* pid 2 queues, the server finishes before pid 2 checks it again */
+    interleave = client_server_finishes;
+    run(&processes[2], client, 12, false);
+    check(interleave == NULL, "the call was not queued");
+    check(processes[1].regs.a1 == 101, "first client did not get its reply");
+    check(processes[2].regs.a1 == 102, "second client did not get its reply");
+    check(processes[0].state == (CHANNEL << 48 | PROC_STATE_WAITING), "server is not waiting");
+    check(processes[2].regs.a0 == ERROR_OK, "second client was interrupted");
+}
+
+/* Receiver pid 0 takes the message of the parked pid 2, then waits */
+static void sender_receiver_takes(void)
+{
+    cap_t receiver = cap_mk_receiver(CHANNEL, 0);
+    run(&processes[0], receiver, 0, 0);
+    check(processes[0].regs.a1 == 22, "receiver did not take the parked message");
+    run(&processes[0], receiver, 0, 0);
+}
+
+static void sender_race(void)
+{
+    cap_t receiver = cap_mk_receiver(CHANNEL, 0);
+    cap_t sender = cap_mk_sender(CHANNEL, 0);
+    reset("sender");
+    /* Receiver is busy with an earlier message */
+    run(&processes[0], receiver, 0, 0);
+    processes[0].state = PROC_STATE_RUNNING;
+    /* pid 2 parks, the receiver takes its message before pid 2 checks it again */
+    interleave = sender_receiver_takes;
+    run(&processes[2], sender, 22, 0);
+    check(interleave == NULL, "the sender did not park");
+    check(processes[2].regs.a0 == ERROR_OK, "sender was interrupted");
+    check(processes[0].state == (CHANNEL << 48 | PROC_STATE_WAITING), "receiver is not waiting");
+}
+
+/* Server pid 0 replies to pid 1 and takes the call of pid 2, ready to receive a capability */
+static void call_server_finishes(void)
+{
+    cap_t server = cap_mk_server(CHANNEL, 0);
+    processes[0].regs.dest_cidx = 0;
+    run(&processes[0], server, 101, true);
+    check(processes[0].regs.a1 == 12, "server did not take the queued call");
+}
+
+static void call_race(void)
+{
+    cap_t server = cap_mk_server(CHANNEL, 0);
+    cap_t client = cap_mk_client(CHANNEL, 0);
+    reset("call");
+    cap_node_insert(client, &cap_tables[2][1], &sentinel);
+    cap_node_insert(cap_mk_memory(0, 1, 0x7, 0, 0), &cap_tables[2][2], &sentinel);
+    /* Server is busy with pid 1 */
+    run(&processes[0], server, 0, true);
+    run(&processes[1], client, 11, false);
+    processes[0].state = PROC_STATE_RUNNING;
+    /* pid 2 calls with a5 still naming its memory capability */
+    processes[2].regs.a5 = 2;
+    interleave = call_server_finishes;
+    run_call(&processes[2], 1, 12);
+    check(interleave == NULL, "the call was not queued");
+    check(cap_is_type(cap_node_get_cap(&cap_tables[2][2]), CAP_TYPE_MEMORY), "the call sent a capability");
+    check(cap_node_is_deleted(&cap_tables[0][0]), "the server received a capability");
+}
+
+static void donate_race(void)
+{
+    cap_t server = cap_mk_server(CHANNEL, 0);
+    cap_t client = cap_mk_client(CHANNEL, 0);
+    reset("donate");
+    run(&processes[0], server, 0, true);
+    /* pid 1 calls in its slot and donates it, the reply gives it back */
+    slot_owner = 1;
+    run(&processes[1], client, 11, true);
+    check(donated == &processes[0], "the client did not donate its slot");
+    run(&processes[0], server, 101, true);
+    check(donated == &processes[1], "the reply did not give the slot back");
+    check(processes[1].regs.a1 == 101, "client did not get its first reply");
+    /* pid 1 donates again, the slot ends before the server replies in its own slot */
+    run(&processes[1], client, 12, true);
+    slot_owner = 0;
+    donated = NULL;
+    run(&processes[0], server, 102, true);
+    check(donated == NULL, "the reply donated the slot of the server");
+    check(processes[1].regs.a1 == 102, "client did not get its second reply");
+    check(processes[1].state == PROC_STATE_READY, "client is not ready");
+    check(processes[0].client == NULL, "server still has a client to give a slot to");
+}
+
+/* Revoke the capability in slot 0 of pid 3 */
+static void revoke_channels(void)
+{
+    proc_t* prev = current;
+    current = &processes[3];
+    current->state = PROC_STATE_RUNNING;
+    check(syscall_revoke_cap(0) == ERROR_OK, "revoke failed");
+    current = prev;
+}
+
+static void revoke_race(void)
+{
+    cap_t server = cap_mk_server(CHANNEL, 0);
+    cap_t client = cap_mk_client(CHANNEL, 0);
+    reset("revoke");
+    cap_t channels = cap_channels_set_free(cap_mk_channels(CHANNEL, CHANNEL + 1, CHANNEL), CHANNEL + 1);
+    cap_node_insert(channels, &cap_tables[3][0], &sentinel);
+    cap_node_insert(server, &cap_tables[0][0], &cap_tables[3][0]);
+    /* Server is busy with pid 1, pid 2 queues */
+    run(&processes[0], server, 0, true);
+    run(&processes[1], client, 11, false);
+    processes[0].state = PROC_STATE_RUNNING;
+    run(&processes[2], client, 12, false);
+    check(!waitq_is_empty(CHANNEL), "the call was not queued");
+    revoke_channels();
+    check(cap_node_is_deleted(&cap_tables[0][0]), "the server capability was not revoked");
+    check(receivers[CHANNEL][0] == NULL, "the revoker was published as the server");
+    check(waitq_is_empty(CHANNEL), "the queued client was left on the channel");
+    check(processes[2].regs.a0 == ERROR_NO_RECEIVER, "the queued client was not rejected");
+    check(processes[2].state == PROC_STATE_READY, "the queued client is not ready");
+}
+
+static void park_race(void)
+{
+    cap_t receiver = cap_mk_receiver(CHANNEL, 0);
+    cap_t sender = cap_mk_sender(CHANNEL, 0);
+    reset("park");
+    cap_t channels = cap_channels_set_free(cap_mk_channels(CHANNEL, CHANNEL + 1, CHANNEL), CHANNEL + 1);
+    cap_node_insert(channels, &cap_tables[3][0], &sentinel);
+    cap_node_insert(receiver, &cap_tables[0][0], &cap_tables[3][0]);
+    /* Receiver is busy with an earlier message, pid 2 parks */
+    run(&processes[0], receiver, 0, 0);
+    processes[0].state = PROC_STATE_RUNNING;
+    run(&processes[2], sender, 22, 0);
+    check(!waitq_is_empty(CHANNEL), "the sender did not park");
+    revoke_channels();
+    check(receivers[CHANNEL][0] == NULL, "the revoker was published as the receiver");
+    check(waitq_is_empty(CHANNEL), "the parked sender was left on the channel");
+    check(processes[2].regs.a0 == ERROR_NO_RECEIVER, "the parked sender was not woken with an error");
+    check(processes[2].state == PROC_STATE_READY, "the parked sender is not ready");
+}
+
+static void multicast_race(void)
+{
+    cap_t server = cap_mk_server(CHANNEL, 0);
+    cap_t receiver = cap_mk_receiver(CHANNEL + 1, 0);
+    reset("multicast");
+    cap_node_insert(server, &cap_tables[0][0], &sentinel);
+    cap_node_insert(receiver, &cap_tables[1][0], &sentinel);
+    cap_update_hook(&processes[0], &cap_tables[0][0], server);
+    cap_update_hook(&processes[1], &cap_tables[1][0], receiver);
+    run(&processes[0], server, 0, true);
+    run(&processes[1], receiver, 0, 0);
+    current = &processes[2];
+    current->state = PROC_STATE_RUNNING;
+    check(syscall_invoke_multicast(cap_mk_multicast(CHANNEL, CHANNEL + 2), 31, 0, 0, 0, 0) == ERROR_OK,
+          "multicast failed");
+    current = NULL;
+    check(processes[2].regs.a1 == 1, "multicast did not deliver to exactly one process");
+    check(processes[1].regs.a1 == 31, "the receiver did not get the message");
+    check(processes[0].state == (CHANNEL << 48 | PROC_STATE_WAITING), "the server got the message");
+}
+
+int main(void)
+{
+    client_race();
+    sender_race();
+    call_race();
+    donate_race();
+    revoke_race();
+    park_race();
+    multicast_race();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,150 @@
+// See LICENSE file for copyright and license details.
+/*
+ * Host-side revoke benchmark.
+ *
+ * Derives n memory capabilities from one parent, next to n unrelated ones,
+ * and measures, with the kernel's capability list (src/cap_node.c):
+ *     walk     the linear walk of syscall_revoke_cap, deleting each child.
+ *     revoke   the whole revoke, the fence, the walk reclaiming the children
+ *              and the end of the fence.
+ *     fence    cap_node_revoke_begin, after which every child reads as deleted.
+ *     get_cap  cap_node_get_cap on a node, without a revoke in progress, and
+ *              during one on a revoked child and on an unrelated node, first
+ *              and again in the same fence generation.
+ * Times are the best of several rounds, in nanoseconds.
+ *     revoke_bench [n]   Number of children, default 4096.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cap_node.c"
+
+#define ROUNDS 16
+#define MAX_CHILDREN 65536
+
+static cap_node_t sentinel;
+static cap_node_t parent;
+static cap_node_t children[MAX_CHILDREN];
+static cap_node_t others[MAX_CHILDREN];
+
+int kprintf(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vfprintf(stderr, format, args);
+    va_end(args);
+    return n;
+}
+
+void hang(void)
+{
+    exit(2);
+}
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Parent with n children, each derived as by syscall_derive_cap, after n unrelated nodes */
+static void build(uint64_t n)
+{
+    sentinel.prev = &sentinel;
+    sentinel.next = &sentinel;
+    for (uint64_t i = 0; i < n; i++) {
+        others[i].prev = NULL;
+        cap_node_insert(cap_mk_memory(n + i, n + i + 1, 0x7, n + i, 0), &others[i], &sentinel);
+    }
+    parent.prev = NULL;
+    cap_node_insert(cap_mk_memory(0, n, 0x7, 0, 0), &parent, &sentinel);
+    for (uint64_t i = 0; i < n; i++) {
+        cap_t cap = cap_mk_memory(i, i + 1, 0x7, i, 0);
+        if (!cap_can_derive(parent.cap, cap))
+            hang();
+        parent.cap = cap_memory_set_free(parent.cap, i + 1);
+        children[i].prev = NULL;
+        cap_node_insert(cap, &children[i], &parent);
+    }
+}
+
+/* Loop of revoke_walk, without the hooks */
+static void walk(void)
+{
+    cap_t cap = parent.cap;
+    while (cap_is_child(cap, parent.next->cap))
+        cap_node_delete2(parent.next, &parent);
+}
+
+/* Time per node of cap_node_get_cap on n nodes, which must read as live or not */
+static uint64_t get_caps(cap_node_t* nodes, uint64_t n, bool live)
+{
+    uint64_t t0 = now();
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < n; i++)
+        count += !cap_is_type(cap_node_get_cap(&nodes[i]), CAP_TYPE_EMPTY);
+    uint64_t t = (now() - t0) / n;
+    if (count != (live ? n : 0))
+        hang();
+    return t;
+}
+
+static uint64_t best(uint64_t a, uint64_t b)
+{
+    return a < b ? a : b;
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t n = (argc > 1) ? strtoull(argv[1], NULL, 0) : 4096;
+    if (n == 0 || n > MAX_CHILDREN) {
+        fprintf(stderr, "usage: %s [n], 0 < n <= %d\n", argv[0], MAX_CHILDREN);
+        return 1;
+    }
+
+    uint64_t t_walk = -1, t_revoke = -1, t_fence = -1;
+    uint64_t t_get = -1, t_get_revoked = -1, t_get_first = -1, t_get_again = -1;
+    for (int r = 0; r < ROUNDS; r++) {
+        build(n);
+        uint64_t t0 = now();
+        walk();
+        t_walk = best(t_walk, now() - t0);
+
+        build(n);
+        t0 = now();
+        cap_node_revoke_begin(&parent, 0);
+        walk();
+        cap_node_revoke_end(&parent, 0);
+        t_revoke = best(t_revoke, now() - t0);
+        if (parent.next != &others[n - 1] || cap_revokes != 0)
+            hang();
+
+        build(n);
+        t_get = best(t_get, get_caps(children, n, true));
+
+        t0 = now();
+        cap_node_revoke_begin(&parent, 0);
+        t_fence = best(t_fence, now() - t0);
+
+        t_get_revoked = best(t_get_revoked, get_caps(children, n, false));
+        t_get_first = best(t_get_first, get_caps(others, n, true));
+        t_get_again = best(t_get_again, get_caps(others, n, true));
+        if (!cap_is_type(cap_node_get_cap(&parent), CAP_TYPE_MEMORY))
+            hang();
+
+        /* The walk still reclaims the nodes */
+        walk();
+        cap_node_revoke_end(&parent, 0);
+    }
+
+    printf("children  %lu\n", n);
+    printf("walk      %lu ns\n", t_walk);
+    printf("revoke    %lu ns\n", t_revoke);
+    printf("fence     %lu ns\n", t_fence);
+    printf("get_cap   %lu ns, during a revoke %lu ns revoked, %lu ns unrelated, %lu ns again\n", t_get,
+           t_get_revoked, t_get_first, t_get_again);
+    return 0;
+}
@@ -0,0 +1,389 @@
+// See LICENSE file for copyright and license details.
+/*
+ * Host-side schedule simulator.
+ *
+ * Builds the kernel's schedule tables (src/sched.c) from a script of time
+ * capability derivations and reports, per process and hart, utilization,
+ * worst-case gap between slots, time lost to the scheduler ticks, and the
+ * quanta lost to the lower-hart rule or the active schedule mode.
+ *
+ * Script format, one command per line, '#' starts a comment. Hart h starts
+ * with the time capability 'h<h>' covering the whole major frame, owned by
+ * process 0. Updates made in a major frame are dispatched from the next.
+ *     derive <name> <parent> <begin> <end>   Derive a time capability.
+ *     move <name> <pid>                      Move a capability to process pid.
+ *     revoke <name>                          Revoke all children of a capability.
+ *     save <mode>                            Save the granted time as a schedule mode.
+ *     load <mode>                            Switch to a schedule mode.
+ *     next                                   Go to the next major frame.
+ *     expect <hart> <quantum> <pid|->        Check the pid dispatched at a quantum
+ *                                            of this major frame, '-' for none.
+ * The report is for the major frame after the script.
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The simulator has no timer to calibrate against */
+#undef SCHEDULER_CALIBRATE
+#undef SCHEDULER_TRACK
+/* The script runs at the beginning of major frame sim_frame */
+static uint64_t sim_frame;
+#define read_time() (sim_frame * N_QUANTUM * TICKS)
+#include "sched.c"
+
+#define N_SIM_CAPS (N_PROC * N_CAPS)
+#define NAME_LENGTH 32
+
+typedef struct sim_cap {
+    char name[NAME_LENGTH];
+    cap_t cap;
+    cap_node_t node;
+    uint64_t pid;
+    int parent;
+} sim_cap_t;
+
+/* Stand-ins for kernel symbols used by sched.c */
+proc_t processes[N_PROC];
+proc_t* current;
+cap_node_t cap_tables[N_PROC][N_CAPS];
+cap_node_t* volatile cap_revoking[N_PROC];
+volatile uint64_t cap_revokes;
+volatile uint64_t cap_fence_gen = 1;
+uint64_t cap_stamp;
+
+static sim_cap_t caps[N_SIM_CAPS];
+static int n_caps;
+static int line_nr;
+
+int kprintf(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vfprintf(stderr, format, args);
+    va_end(args);
+    return n;
+}
+
+void hang(void)
+{
+    exit(2);
+}
+
+void trap_resume_proc(void)
+{
+    exit(2);
+}
+
+static void fail(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "line %d: ", line_nr);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+static int sim_find(const char* name)
+{
+    for (int i = 0; i < n_caps; i++) {
+        if (strcmp(caps[i].name, name) == 0 && !cap_node_is_deleted(&caps[i].node))
+            return i;
+    }
+    fail("no capability '%s'", name);
+    return -1;
+}
+
+static int sim_add(const char* name, cap_t cap, uint64_t pid, int parent)
+{
+    if (n_caps == N_SIM_CAPS)
+        fail("too many capabilities");
+    sim_cap_t* c = &caps[n_caps];
+    snprintf(c->name, NAME_LENGTH, "%s", name);
+    c->cap = cap;
+    c->node.prev = &c->node;
+    c->node.next = &c->node;
+    c->pid = pid;
+    c->parent = parent;
+    return n_caps++;
+}
+
+/* Same as cap_update_hook for time capabilities */
+static void sim_update(sim_cap_t* c, uint64_t pid)
+{
+    sched_update(&c->node, cap_time_get_hartid(c->cap), cap_time_get_free(c->cap), cap_time_get_end(c->cap), pid);
+}
+
+static void sim_derive(const char* name, const char* parent_name, uint64_t begin, uint64_t end)
+{
+    int p = sim_find(parent_name);
+    uint64_t hartid = cap_time_get_hartid(caps[p].cap);
+    if (begin >= end || end > N_QUANTUM)
+        fail("invalid time slice [%lu, %lu)", begin, end);
+    cap_t cap = cap_mk_time(hartid, begin, end, begin);
+    if (!cap_can_derive(caps[p].cap, cap))
+        fail("can not derive [%lu, %lu) from '%s'", begin, end, parent_name);
+    if (!sched_reserve(hartid))
+        fail("schedule is full, increase N_SLOTS");
+    caps[p].cap = cap_time_set_free(caps[p].cap, end);
+    int c = sim_add(name, cap, caps[p].pid, p);
+    sim_update(&caps[c], caps[c].pid);
+}
+
+static void sim_move(const char* name, uint64_t pid)
+{
+    int c = sim_find(name);
+    if (pid >= N_PROC)
+        fail("invalid pid %lu", pid);
+    caps[c].pid = pid;
+    sim_update(&caps[c], pid);
+}
+
+static bool sim_is_descendant(int c, int p)
+{
+    for (c = caps[c].parent; c >= 0; c = caps[c].parent) {
+        if (c == p)
+            return true;
+    }
+    return false;
+}
+
+static void sim_revoke(const char* name)
+{
+    int p = sim_find(name);
+    /* Time of children is released as on delete, then goes back with the revoked capability */
+    for (int c = 0; c < n_caps; c++) {
+        if (cap_node_is_deleted(&caps[c].node) || !sim_is_descendant(c, p))
+            continue;
+        sim_update(&caps[c], INVALID_PID);
+        caps[c].node.prev = NULL;
+        sched_unreserve(cap_time_get_hartid(caps[c].cap));
+    }
+    caps[p].cap = cap_time_set_free(caps[p].cap, cap_time_get_begin(caps[p].cap));
+    sim_update(&caps[p], caps[p].pid);
+}
+
+static void sim_save(uint64_t mode)
+{
+    if (!sched_save_mode(mode))
+        fail("invalid mode %lu", mode);
+}
+
+static void sim_load(uint64_t mode)
+{
+    if (!sched_load_mode(mode))
+        fail("can not load mode %lu", mode);
+}
+
+/* Updates are published at the next major frame boundary, not within the frame */
+static void sim_next(void)
+{
+    uint64_t e = epoch;
+    sched_publish(sim_frame);
+    if (epoch != e)
+        fail("updates published within the major frame");
+    sim_frame++;
+    sched_publish(sim_frame);
+}
+
+/* Pid dispatched at quantum q of this major frame on hartid, using the kernel's lookup */
+static uint64_t sim_dispatched(uint64_t hartid, uint64_t q)
+{
+    proc_t* proc;
+    uint64_t length;
+    uint64_t time = sim_frame * N_QUANTUM + q;
+    if (!sched_get_proc(hartid, &time, &proc, &length) || time != sim_frame * N_QUANTUM + q)
+        return INVALID_PID;
+    return proc - processes;
+}
+
+static void sim_expect(uint64_t hartid, uint64_t q, const char* expected)
+{
+    if (hartid < MIN_HARTID || hartid > MAX_HARTID || q >= N_QUANTUM)
+        fail("invalid quantum %lu on hart %lu", q, hartid);
+    uint64_t pid = sim_dispatched(hartid, q);
+    uint64_t want = (strcmp(expected, "-") == 0) ? INVALID_PID : strtoul(expected, NULL, 10);
+    if (pid != want)
+        fail("hart %lu dispatches %ld at quantum %lu, expected %s", hartid, pid == INVALID_PID ? -1l : (long)pid, q,
+             expected);
+}
+
+static void sim_run_script(FILE* f)
+{
+    char line[256], cmd[NAME_LENGTH], a[NAME_LENGTH], b[NAME_LENGTH];
+    uint64_t x, y;
+    while (fgets(line, sizeof(line), f)) {
+        line_nr++;
+        char* comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+        if (sscanf(line, "%31s", cmd) != 1)
+            continue;
+        if (strcmp(cmd, "derive") == 0 && sscanf(line, "%*s %31s %31s %lu %lu", a, b, &x, &y) == 4)
+            sim_derive(a, b, x, y);
+        else if (strcmp(cmd, "move") == 0 && sscanf(line, "%*s %31s %lu", a, &x) == 2)
+            sim_move(a, x);
+        else if (strcmp(cmd, "revoke") == 0 && sscanf(line, "%*s %31s", a) == 1)
+            sim_revoke(a);
+        else if (strcmp(cmd, "save") == 0 && sscanf(line, "%*s %lu", &x) == 1)
+            sim_save(x);
+        else if (strcmp(cmd, "load") == 0 && sscanf(line, "%*s %lu", &x) == 1)
+            sim_load(x);
+        else if (strcmp(cmd, "next") == 0)
+            sim_next();
+        else if (strcmp(cmd, "expect") == 0 && sscanf(line, "%*s %lu %lu %31s", &x, &y, a) == 3)
+            sim_expect(x, y, a);
+        else
+            fail("invalid command");
+    }
+}
+
+static uint64_t sim_owner(uint64_t hartid, uint64_t q)
+{
+    sched_table_t* owners = sched_owners(&buffers[epoch % 2], hartid);
+    return owners->slots[sched_slot_find(owners, q)].pid;
+}
+
+/* Lowest hart that owns the same process at quantum q, hartid if none */
+static uint64_t sim_winner(uint64_t hartid, uint64_t q)
+{
+    uint64_t pid = sim_owner(hartid, q);
+    uint64_t winner = MIN_HARTID;
+    while (winner < hartid && sim_owner(winner, q) != pid)
+        winner++;
+    return winner;
+}
+
+static double ticks_to_us(uint64_t ticks)
+{
+    return ticks * 1000000.0 / TICKS_PER_SECOND;
+}
+
+static uint64_t dispatch[N_HARTS][N_QUANTUM];
+
+static void sim_report(void)
+{
+    uint64_t usable[N_PROC][N_HARTS] = {{0}};
+    uint64_t lost[N_HARTS] = {0};
+    uint64_t slots[N_HARTS] = {0};
+
+    for (uint64_t h = 0; h < N_HARTS; h++) {
+        for (uint64_t q = 0; q < N_QUANTUM; q++)
+            dispatch[h][q] = sim_dispatched(h + MIN_HARTID, q);
+    }
+
+    printf("Major frame: %d quanta of %lu ticks (%.1f us), scheduler ticks %lu\n\n", N_QUANTUM, (uint64_t)TICKS,
+           ticks_to_us(TICKS), scheduler_ticks);
+
+    /* Slots and slack, each slot loses scheduler_ticks at its end */
+    printf("Slots:\n");
+    for (uint64_t h = 0; h < N_HARTS; h++) {
+        printf("  hart %lu:", h + MIN_HARTID);
+        for (uint64_t q = 0; q < N_QUANTUM;) {
+            uint64_t pid = dispatch[h][q];
+            uint64_t end = q + 1;
+            while (end < N_QUANTUM && dispatch[h][end] == pid)
+                end++;
+            if (pid != INVALID_PID) {
+                uint64_t ticks = (end - q) * TICKS;
+                uint64_t slack = ticks < scheduler_ticks ? ticks : scheduler_ticks;
+                usable[pid][h] += ticks - slack;
+                lost[h] += slack;
+                slots[h]++;
+                printf(" [%lu,%lu)=%lu", q, end, pid);
+            }
+            q = end;
+        }
+        printf("\n");
+    }
+
+    printf("\nUtilization (%% of major frame, after scheduler ticks):\n  pid ");
+    for (uint64_t h = 0; h < N_HARTS; h++)
+        printf("  hart %-3lu", h + MIN_HARTID);
+    printf("     total\n");
+    for (uint64_t pid = 0; pid < N_PROC; pid++) {
+        uint64_t total = 0;
+        printf("  %-4lu", pid);
+        for (uint64_t h = 0; h < N_HARTS; h++) {
+            printf("  %7.2f%%", 100.0 * usable[pid][h] / (N_QUANTUM * TICKS));
+            total += usable[pid][h];
+        }
+        printf("  %7.2f%%\n", 100.0 * total / (N_QUANTUM * TICKS));
+    }
+
+    /* Longest cyclic run of quanta where the pid runs on no hart */
+    printf("\nWorst-case gap between slots:\n");
+    for (uint64_t pid = 0; pid < N_PROC; pid++) {
+        uint64_t gap = 0, worst = 0;
+        bool runs = false;
+        for (uint64_t i = 0; i < 2 * N_QUANTUM; i++) {
+            bool running = false;
+            for (uint64_t h = 0; h < N_HARTS; h++)
+                running |= dispatch[h][i % N_QUANTUM] == pid;
+            runs |= running;
+            gap = running ? 0 : gap + 1;
+            if (gap > worst)
+                worst = gap;
+        }
+        if (runs)
+            printf("  pid %lu: %lu quanta (%.1f us)\n", pid, worst, ticks_to_us(worst * TICKS));
+        else
+            printf("  pid %lu: never runs\n", pid);
+    }
+
+    printf("\nScheduler ticks lost:\n");
+    for (uint64_t h = 0; h < N_HARTS; h++) {
+        printf("  hart %lu: %lu slots, %lu ticks (%.2f%% of major frame)\n", h + MIN_HARTID, slots[h], lost[h],
+               100.0 * lost[h] / (N_QUANTUM * TICKS));
+    }
+
+    uint64_t mode = buffers[epoch % 2].mode;
+    printf("\nQuanta dropped by the lower-hart rule or the schedule mode:\n");
+    bool any = false;
+    for (uint64_t h = 0; h < N_HARTS; h++) {
+        for (uint64_t q = 0; q < N_QUANTUM;) {
+            uint64_t pid = sim_owner(h + MIN_HARTID, q);
+            if (pid == INVALID_PID || dispatch[h][q] != INVALID_PID) {
+                q++;
+                continue;
+            }
+            uint64_t winner = sim_winner(h + MIN_HARTID, q);
+            uint64_t end = q + 1;
+            while (end < N_QUANTUM && sim_owner(h + MIN_HARTID, end) == pid && dispatch[h][end] == INVALID_PID
+                   && sim_winner(h + MIN_HARTID, end) == winner)
+                end++;
+            if (winner < h + MIN_HARTID)
+                printf("  hart %lu: [%lu,%lu) of pid %lu runs on hart %lu\n", h + MIN_HARTID, q, end, pid, winner);
+            else
+                printf("  hart %lu: [%lu,%lu) of pid %lu is dropped by mode %lu\n", h + MIN_HARTID, q, end, pid, mode);
+            any = true;
+            q = end;
+        }
+    }
+    if (!any)
+        printf("  none\n");
+}
+
+int main(int argc, char* argv[])
+{
+    FILE* f = stdin;
+    if (argc > 1 && (f = fopen(argv[1], "r")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    sched_init();
+    for (uint64_t hartid = MIN_HARTID; hartid <= MAX_HARTID; hartid++) {
+        char name[NAME_LENGTH];
+        snprintf(name, NAME_LENGTH, "h%lu", hartid);
+        sim_add(name, cap_mk_time(hartid, 0, N_QUANTUM, 0), 0, -1);
+    }
+    sim_run_script(f);
+    sim_next();
+    sim_report();
+    return 0;
+}
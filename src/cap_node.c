@@ -7,3 +7,8 @@
 
 /** Capability table */
 cap_node_t cap_tables[N_PROC][N_CAPS];
+/* Revokes in progress, defined in cap_node.h */
+cap_node_t* volatile cap_revoking[N_PROC];
+volatile uint64_t cap_revokes;
+volatile uint64_t cap_fence_gen = 1;
+uint64_t cap_stamp;
@@ -1,6 +1,8 @@
 // See LICENSE file for copyright and license details.
 #include "exception.h"
 
+#include "csr.h"
+#include "fpu.h"
 #include "preemption.h"
 #include "sched.h"
 
@@ -15,6 +17,11 @@ void exception_handler(uint64_t mcause, uint64_t mtval, uint64_t mepc)
         current->regs.pc = current->regs.ppc;
         current->regs.a0 = current->regs.pa0;
         current->regs.a1 = current->regs.pa1;
+#ifdef __riscv_flen
+    } else if (mcause == ILLEGAL_INSTRUCTION && (read_csr(mstatus) & MSTATUS_FS) == MSTATUS_FS_OFF) {
+        /* Possibly a floating-point instruction, load the registers and retry */
+        fpu_load(current);
+#endif
     } else {
         /* Save pc, sp, a0, a1 to trap frame */
         current->regs.ppc = mepc;
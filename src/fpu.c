@@ -0,0 +1,38 @@
+// See LICENSE file for copyright and license details.
+#include "fpu.h"
+
+#ifdef __riscv_flen
+#include "atomic.h"
+#include "csr.h"
+#include "kassert.h"
+
+/*
+ * Floating-point registers are switched lazily. A process is resumed with
+ * mstatus.FS off unless its registers are still loaded on the hart, so its
+ * first floating-point instruction traps and fpu_load brings them in. Dirty
+ * registers are spilled to the process in trap.S before it can leave the
+ * hart, so memory always holds the latest copy of a process not running.
+ */
+
+/* Process whose registers are loaded on each hart */
+static proc_t* owners[N_HARTS];
+
+void fpu_init(proc_t* proc)
+{
+    proc->fpu.hartid = FPU_NO_HART;
+}
+
+void fpu_load(proc_t* proc)
+{
+    uint64_t hartid = read_csr(mhartid);
+    kassert(MIN_HARTID <= hartid && hartid <= MAX_HARTID);
+    proc_t* owner = owners[hartid - MIN_HARTID];
+    /* The owner may have loaded its registers on another hart meanwhile */
+    if (owner != NULL)
+        (void)compare_and_swap(&owner->fpu.hartid, hartid, FPU_NO_HART);
+    owners[hartid - MIN_HARTID] = proc;
+    proc->fpu.hartid = hartid;
+    set_csr(mstatus, MSTATUS_FS_CLEAN);
+    fpu_load_regs(&proc->fpu);
+}
+#endif
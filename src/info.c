@@ -1,6 +1,7 @@
 // See LICENSE file for copyright and license details.
 #include "info.h"
 #include "kprint.h"
+#include "sched.h"
 
 void print_info()
 {
@@ -14,7 +15,9 @@ void print_info()
     kprintf("Major frame length:           %d ticks\n", TICKS * N_QUANTUM);
     kprintf("Minor frame granularity:      %d ticks\n", TICKS);
     kprintf("Max quanta per major frame:   %d\n", N_QUANTUM);
-    kprintf("Slack/scheduler ticks:        %d\n", SCHEDULER_TICKS);
+    kprintf("Max slots per schedule:       %d\n", N_SLOTS);
+    kprintf("Slack/scheduler ticks:        %lu\n", sched_get_scheduler_ticks());
+    kprintf("Measured dispatch ticks:      %lu\n", sched_get_measured_ticks());
     kprintf("Ticks per second:             %d\n", TICKS_PER_SECOND);
     kprintf("===================================================\n");
 }
@@ -2,6 +2,7 @@
 #include "proc.h"
 
 #include "csr.h"
+#include "fpu.h"
 #include "kprint.h"
 
 #define ARRAY_SIZE(x) ((sizeof(x) / sizeof(x[0])))
@@ -95,6 +96,12 @@ void proc_init_proc(proc_t* proc, uint64_t pid)
     proc->cap_table = cap_tables[pid];
     /* All processes are by default suspended */
     proc->state = PROC_STATE_SUSPENDED;
+    /* No IPC buffer */
+    proc->regs.ipc_cidx = -1;
+#ifdef __riscv_flen
+    /* Floating-point registers are loaded on first use */
+    fpu_init(proc);
+#endif
 }
 
 void proc_init_root(proc_t* root, uint64_t root_payload)
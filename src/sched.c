@@ -10,118 +10,572 @@
 #include "proc_state.h"
 #include "trap.h"
 
-static uint16_t schedule[N_QUANTUM][N_HARTS];
-static lock_t lock = INIT_LOCK;
+_Static_assert(N_QUANTUM <= 0xFFFF, "N_QUANTUM must fit in the 16-bit fields of time capabilities");
+_Static_assert(N_SLOTS <= N_QUANTUM, "N_SLOTS can not exceed N_QUANTUM");
+_Static_assert(TICKS > 0, "Quanta must be at least one tick, decrease N_QUANTUM or increase MAJOR_FRAME_US");
+_Static_assert((3 * N_HARTS < N_QUANTUM ? 3 * N_HARTS : N_QUANTUM) <= N_SLOTS,
+               "N_SLOTS must fit the initial time capabilities of every hart");
+_Static_assert(TICKS > SCHEDULER_TICKS, "Quanta must be longer than the scheduler ticks, decrease SCHEDULER_US or N_QUANTUM");
+
+/* Index used when there is no next valid slot. */
+#define NO_SLOT 0xFFFFull
+/* Mode used when no mode is loaded. */
+#define NO_MODE N_SCHED_MODES
 
-typedef struct sched_entry {
+/*
+ * A slot is an interval of quanta [begin, end) owned by one pid. The end of
+ * slot i is the beginning of slot i + 1, or N_QUANTUM for the last slot.
+ */
+typedef struct sched_slot {
+    uint16_t begin;
+    /* Index of the next slot (cyclically) with a valid pid. */
+    uint16_t next;
     uint8_t pid;
-    uint8_t length;
-} sched_entry_t;
+} sched_slot_t;
+
+/*
+ * Sorted slots covering the quanta 0 .. N_QUANTUM-1 of one hart. The memory
+ * depends on N_SLOTS, not N_QUANTUM, so fine-grained quanta are cheap as long
+ * as the schedule has few slots.
+ */
+typedef struct sched_table {
+    uint64_t length;
+    sched_slot_t slots[N_SLOTS];
+} sched_table_t;
+
+/*
+ * Tables of all harts. The owner tables are updated from time capabilities
+ * only. The dispatch tables are derived from the owner tables, with slots
+ * removed where a lower hart owns the same pid or the active mode does not
+ * run the pid, so dispatch needs a single lookup.
+ */
+typedef struct sched_buffer {
+    sched_table_t owners[N_HARTS];
+    sched_table_t tables[N_HARTS];
+    /* Active mode, NO_MODE if none */
+    uint64_t mode;
+} sched_buffer_t;
+
+/*
+ * The active buffer is buffers[epoch % 2] and is only read. Updates go to the
+ * shadow buffer, which is published at the next major frame boundary by
+ * incrementing epoch.
+ */
+static sched_buffer_t buffers[2];
+static volatile uint64_t epoch;
+/* First major frame of the active buffer. */
+static uint64_t active_frame;
+/* Shadow buffer has updates not yet published. */
+static volatile bool shadow_dirty;
+/* Last major frame in which the shadow buffer was updated. */
+static volatile uint64_t dirty_frame;
+/* Shadow buffer is older than the active buffer. */
+static bool shadow_stale;
+/* Scratch table used by sched_update. */
+static sched_table_t scratch;
+/* Lock for updating and publishing the shadow buffer. */
+static lock_t lock = INIT_LOCK;
+/* Ticks subtracted from the end of slots for the scheduler's overhead. */
+static volatile uint64_t scheduler_ticks = SCHEDULER_TICKS;
+/* Worst-case dispatch path measured, in ticks. */
+static volatile uint64_t measured_ticks;
+/* Number of dispatches measured. */
+static volatile uint64_t measured_samples;
+/* Masks of the precomputed schedule modes, owner tables saved by sched_save_mode. */
+static sched_table_t modes[N_SCHED_MODES][N_HARTS];
+static bool mode_saved[N_SCHED_MODES];
+/* Live time capabilities of each hart, their slots are reserved by sched_reserve. */
+static uint64_t live_caps[N_HARTS];
+/*
+ * Background process of the slots of each pid on each hart, set by that pid
+ * with one of its time capabilities on the hart. The entry is cleared when
+ * the capability is deleted, revoked or moved.
+ */
+typedef struct sched_background {
+    cap_node_t* cn;
+    uint64_t pid;
+} sched_background_t;
+
+static sched_background_t background[N_HARTS][N_PROC];
+/* Owner of the slot each hart dispatched last. */
+static uint64_t slot_owner[N_HARTS];
 
-static inline sched_entry_t sched_get(uint64_t q, uint64_t hartid);
-static inline void sched_set(uint64_t q, uint64_t hartid, uint64_t pid, uint64_t length);
-static inline bool sched_get_proc(uint64_t hartid, uint64_t time, proc_t** proc, uint64_t* length);
+static inline sched_table_t* sched_table(sched_buffer_t* buffer, uint64_t hartid);
+static inline sched_table_t* sched_owners(sched_buffer_t* buffer, uint64_t hartid);
+static inline sched_buffer_t* sched_shadow(void);
+static inline uint64_t sched_slot_end(sched_table_t* table, uint64_t i);
+static inline uint64_t sched_slot_find(sched_table_t* table, uint64_t q);
+static inline void sched_slot_push(sched_table_t* table, uint64_t begin, uint64_t pid);
+static void sched_table_assign(sched_table_t* dst, sched_table_t* src, uint64_t begin, uint64_t end, uint64_t pid);
+static void sched_table_link(sched_table_t* table);
+static void sched_table_resolve(sched_buffer_t* buffer, uint64_t hartid);
+static bool sched_fits(uint64_t* live, sched_table_t* masks);
+static inline sched_table_t* sched_masks(uint64_t mode);
+static inline void sched_publish(uint64_t frame);
+static inline void sched_mark_dirty(void);
+static inline bool sched_get_proc(uint64_t hartid, uint64_t* time, proc_t** proc, uint64_t* length);
+static inline void sched_sleep(uint64_t hartid, uint64_t until);
+static inline bool sched_get_background(uint64_t hartid, proc_t* prev, proc_t** proc);
+static inline uint64_t sched_node_pid(cap_node_t* cn);
+static inline uint64_t sched_dispatch_begin(uint64_t hartid);
+static inline void sched_measure(uint64_t ticks);
+static inline void sched_set_scheduler_ticks(uint64_t ticks);
 
 void sched_init(void)
 {
-    for (int i = 0; i < N_QUANTUM; i++) {
-        for (int j = MIN_HARTID; j <= MAX_HARTID; j++) {
-            /* The length of the initial time slices are all N_QUANTUM and pid is 0*/
-            schedule[i][j - MIN_HARTID] = (N_QUANTUM - i) << 8;
-        }
+    for (int hartid = MIN_HARTID; hartid <= MAX_HARTID; hartid++) {
+        /* Initially, pid 0 owns a single slot spanning the whole major frame */
+        sched_table_t* table = sched_owners(&buffers[0], hartid);
+        table->length = 0;
+        sched_slot_push(table, 0, 0);
+        sched_table_link(table);
     }
+    buffers[0].mode = NO_MODE;
+    for (int hartid = MIN_HARTID; hartid <= MAX_HARTID; hartid++) {
+        sched_table_resolve(&buffers[0], hartid);
+        /* The time capability of the hart made by proc_init_time */
+        live_caps[hartid - MIN_HARTID] = 1;
+    }
+    buffers[1] = buffers[0];
 }
 
-sched_entry_t sched_get(uint64_t q, uint64_t hartid)
+uint64_t sched_get_scheduler_ticks(void)
+{
+    return scheduler_ticks;
+}
+
+uint64_t sched_get_measured_ticks(void)
+{
+    return measured_ticks;
+}
+
+/* Time the dispatch started, the expired timeout or now if it has not expired */
+uint64_t sched_dispatch_begin(uint64_t hartid)
+{
+    uint64_t now = read_time();
+    uint64_t timeout = read_timeout(hartid);
+    return timeout < now ? timeout : now;
+}
+
+/*
+ * Record a dispatch that took ticks from the expired timeout, so the trap
+ * entry, schedule lookup and PMP reload are included. After the first
+ * CALIBRATION_ROUNDS dispatches the scheduler ticks are set to the worst
+ * case plus a guard for the trap exit, below SCHEDULER_TICKS if it is
+ * faster. With SCHEDULER_TRACK they are raised by any slower dispatch later.
+ */
+void sched_measure(uint64_t ticks)
+{
+    uint64_t measured;
+    /* Not from a timeout in this quantum, such as the first dispatch at boot */
+    if (ticks >= TICKS)
+        return;
+    do {
+        measured = measured_ticks;
+        if (ticks <= measured)
+            break;
+    } while (!compare_and_set(&measured_ticks, measured, ticks));
+    uint64_t samples = fetch_and_add(&measured_samples, 1) + 1;
+    if (samples == CALIBRATION_ROUNDS)
+        sched_set_scheduler_ticks(measured_ticks + SCHEDULER_GUARD_TICKS);
+#ifdef SCHEDULER_TRACK
+    else if (samples > CALIBRATION_ROUNDS && ticks > measured)
+        sched_set_scheduler_ticks(ticks + SCHEDULER_GUARD_TICKS);
+#endif
+}
+
+/* Set the scheduler ticks, always less than a quantum */
+void sched_set_scheduler_ticks(uint64_t ticks)
+{
+    scheduler_ticks = (ticks < TICKS) ? ticks : TICKS - 1;
+}
+
+sched_table_t* sched_table(sched_buffer_t* buffer, uint64_t hartid)
 {
-    kassert(q < N_QUANTUM);
     kassert(MIN_HARTID <= hartid && hartid <= MAX_HARTID);
-    uint64_t val = schedule[q][hartid - MIN_HARTID];
-    return (sched_entry_t){val & 0xFF, (val >> 8) & 0xFF};
+    return &buffer->tables[hartid - MIN_HARTID];
 }
 
-void sched_set(uint64_t q, uint64_t hartid, uint64_t pid, uint64_t length)
+sched_table_t* sched_owners(sched_buffer_t* buffer, uint64_t hartid)
 {
     kassert(MIN_HARTID <= hartid && hartid <= MAX_HARTID);
+    return &buffer->owners[hartid - MIN_HARTID];
+}
+
+uint64_t sched_slot_end(sched_table_t* table, uint64_t i)
+{
+    return (i + 1 < table->length) ? table->slots[i + 1].begin : N_QUANTUM;
+}
+
+/* Binary search for the slot containing quantum q */
+uint64_t sched_slot_find(sched_table_t* table, uint64_t q)
+{
     kassert(q < N_QUANTUM);
-    kassert(pid == INVALID_PID || pid < N_PROC);
-    kassert((length & 0xFF) == length);
-    schedule[q][hartid - MIN_HARTID] = pid | (length << 8);
+    uint64_t low = 0;
+    uint64_t high = table->length;
+    while (high - low > 1) {
+        uint64_t mid = (low + high) / 2;
+        if (table->slots[mid].begin <= q)
+            low = mid;
+        else
+            high = mid;
+    }
+    return low;
 }
 
-bool sched_get_proc(uint64_t hartid, uint64_t time, proc_t** proc, uint64_t* length)
+/* Append a slot, merging it with the last slot if they have the same pid */
+void sched_slot_push(sched_table_t* table, uint64_t begin, uint64_t pid)
 {
-    /* Calculate the current quantum */
-    uint64_t quantum = time % N_QUANTUM;
-    /* Get the current quantum schedule */
-    synchronize();
-    sched_entry_t entry = sched_get(quantum, hartid);
+    if (table->length > 0 && table->slots[table->length - 1].pid == pid)
+        return;
+    kassert(table->length < N_SLOTS);
+    table->slots[table->length].begin = begin;
+    table->slots[table->length].pid = pid;
+    table->length++;
+}
 
-    /* Check if slot is invalid/inactive */
-    if (entry.pid == INVALID_PID)
-        return false;
+/* Make dst a copy of src where the quanta begin .. end-1 belong to pid */
+void sched_table_assign(sched_table_t* dst, sched_table_t* src, uint64_t begin, uint64_t end, uint64_t pid)
+{
+    dst->length = 0;
+    for (uint64_t i = 0; i < src->length; i++) {
+        uint64_t slot_begin = src->slots[i].begin;
+        uint64_t slot_end = sched_slot_end(src, i);
+        uint64_t slot_pid = src->slots[i].pid;
+        /* Part of slot before the new slot */
+        if (slot_begin < begin)
+            sched_slot_push(dst, slot_begin, slot_pid);
+        /* The new slot */
+        if (slot_begin <= begin && begin < slot_end)
+            sched_slot_push(dst, begin, pid);
+        /* Part of slot after the new slot */
+        if (end < slot_end)
+            sched_slot_push(dst, slot_begin > end ? slot_begin : end, slot_pid);
+    }
+    sched_table_link(dst);
+}
+
+/* Set the next valid slot of each slot */
+void sched_table_link(sched_table_t* table)
+{
+    uint64_t next = NO_SLOT;
+    /* Two passes so the last slots wrap around to the first valid slot */
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint64_t i = table->length; i > 0; i--) {
+            table->slots[i - 1].next = next;
+            if (table->slots[i - 1].pid != INVALID_PID)
+                next = i - 1;
+        }
+    }
+}
 
-    /* Check if some other thread preempts */
-    for (size_t i = MIN_HARTID; i < hartid; i++) {
-        if (entry.pid == sched_get(quantum, i).pid)
+/*
+ * Check that the tables fit in N_SLOTS with live time capabilities on each
+ * hart and masks, NULL if no mode. Each capability owns its time from free
+ * to end, so the owner table of a hart has at most 2 * live + 1 slots,
+ * whatever is deleted, revoked or moved. The dispatch table of a hart has
+ * at most as many slots as the owner tables of that hart and the harts
+ * below and the mask of the hart together, and never more than there are
+ * quanta.
+ */
+bool sched_fits(uint64_t* live, sched_table_t* masks)
+{
+    uint64_t total = 0;
+    for (uint64_t h = 0; h < N_HARTS; h++) {
+        total += 2 * live[h] + 1;
+        uint64_t bound = total + ((masks != NULL) ? masks[h].length : 0);
+        if ((bound < N_QUANTUM ? bound : N_QUANTUM) > N_SLOTS)
             return false;
     }
+    return true;
+}
+
+/* Masks of mode, NULL if no mode */
+sched_table_t* sched_masks(uint64_t mode)
+{
+    return (mode != NO_MODE) ? modes[mode] : NULL;
+}
+
+/*
+ * Derive the dispatch table of hartid from the owner tables. A quantum is
+ * invalid on hartid if a lower hart owns the same pid at that quantum, or
+ * if the active mode has another pid or none there. The mode is a mask, so
+ * it only drops time the owner tables grant.
+ */
+void sched_table_resolve(sched_buffer_t* buffer, uint64_t hartid)
+{
+    /* Current slot index in each owner table and the mask */
+    uint64_t idx[N_HARTS] = {0};
+    uint64_t mask_idx = 0;
+    uint64_t h = hartid - MIN_HARTID;
+    sched_table_t* table = sched_table(buffer, hartid);
+    sched_table_t* mask = (buffer->mode != NO_MODE) ? &modes[buffer->mode][h] : NULL;
+    uint64_t q = 0;
+
+    table->length = 0;
+    while (q < N_QUANTUM) {
+        sched_table_t* owners = &buffer->owners[h];
+        uint64_t pid = owners->slots[idx[h]].pid;
+        uint64_t next = sched_slot_end(owners, idx[h]);
+        for (uint64_t j = 0; j < h; j++) {
+            sched_table_t* other = &buffer->owners[j];
+            uint64_t other_end = sched_slot_end(other, idx[j]);
+            if (other->slots[idx[j]].pid == pid)
+                pid = INVALID_PID;
+            if (other_end < next)
+                next = other_end;
+        }
+        if (mask != NULL) {
+            uint64_t mask_end = sched_slot_end(mask, mask_idx);
+            if (mask->slots[mask_idx].pid != pid)
+                pid = INVALID_PID;
+            if (mask_end < next)
+                next = mask_end;
+            if (mask_end == next)
+                mask_idx++;
+        }
+        sched_slot_push(table, q, pid);
+        /* Advance the slots ending at next */
+        for (uint64_t j = 0; j <= h; j++) {
+            if (sched_slot_end(&buffer->owners[j], idx[j]) == next)
+                idx[j]++;
+        }
+        q = next;
+    }
+    sched_table_link(table);
+}
+
+/*
+ * Publish the shadow buffer if frame is later than the frame of its last
+ * update. Dispatches in that frame all used the active buffer, so every hart
+ * switches buffer at the same major frame boundary.
+ */
+void sched_publish(uint64_t frame)
+{
+    if (!shadow_dirty || frame <= dirty_frame || frame <= active_frame)
+        return;
+    lock_acquire(&lock);
+    if (shadow_dirty && frame > dirty_frame && frame > active_frame) {
+        synchronize();
+        epoch++;
+        active_frame = frame;
+        shadow_dirty = false;
+        shadow_stale = true;
+    }
+    lock_release(&lock);
+}
+
+/*
+ * Mark the shadow buffer as updated. Dispatch looks up the next quantum, so
+ * the frame of the next quantum is the last one a dispatch may have read the
+ * active buffer for. Requires lock.
+ */
+void sched_mark_dirty(void)
+{
+    dirty_frame = (read_time() / TICKS + 1) / N_QUANTUM;
+    synchronize();
+    shadow_dirty = true;
+}
 
-    /* Set proc and length */
-    *proc = &processes[entry.pid];
-    *length = entry.length;
+/*
+ * Get the process of the first valid slot at or after time. Advances time to
+ * the beginning of that slot and sets length to the number of quanta left of it.
+ */
+bool sched_get_proc(uint64_t hartid, uint64_t* time, proc_t** proc, uint64_t* length)
+{
+    uint64_t e, i, pid, quantum, begin;
+    bool found;
+
+    sched_publish(*time / N_QUANTUM);
+
+    /* Lock-free read of the active buffer, retry if it was swapped meanwhile */
+    do {
+        e = epoch;
+        synchronize();
+        sched_table_t* table = sched_table(&buffers[e % 2], hartid);
+        found = false;
+
+        /* Calculate the current quantum */
+        quantum = *time % N_QUANTUM;
+        i = sched_slot_find(table, quantum);
+
+        /* If slot is invalid/inactive, jump to the next valid slot */
+        if (table->slots[i].pid == INVALID_PID) {
+            i = table->slots[i].next;
+            if (i == NO_SLOT)
+                continue;
+            begin = table->slots[i].begin;
+            quantum = begin;
+        }
+
+        /* Slots preempted by lower harts are already removed */
+        pid = table->slots[i].pid;
+        found = true;
+        *length = sched_slot_end(table, i) - quantum;
+        synchronize();
+    } while (e != epoch);
+
+    if (!found)
+        return false;
+    /* Set time and proc */
+    *time += (quantum + N_QUANTUM - (*time % N_QUANTUM)) % N_QUANTUM;
+    *proc = &processes[pid];
     return true;
 }
 
+/* Sleep until the timer reaches until, instead of polling MTIME */
+void sched_sleep(uint64_t hartid, uint64_t until)
+{
+    write_timeout(hartid, until);
+    while (!(read_csr(mip) & 128))
+        wfi();
+}
+
 void wait_and_set_timeout(uint64_t time, uint64_t length, uint64_t timeout)
 {
     uint64_t start_time = time * TICKS;
-    uint64_t end_time = start_time + length * TICKS - SCHEDULER_TICKS;
+    uint64_t end_time = start_time + length * TICKS - scheduler_ticks;
     uint64_t hartid = read_csr(mhartid);
     if (timeout > start_time)
         start_time = timeout;
-    write_timeout(hartid, start_time);
-    while (!(read_csr(mip) & 128))
-        asm volatile("wfi");
+    sched_sleep(hartid, start_time);
     write_timeout(hartid, end_time);
 }
 
+/* Pid of the process whose capability table holds cn */
+uint64_t sched_node_pid(cap_node_t* cn)
+{
+    return (cn - &cap_tables[0][0]) / N_CAPS;
+}
+
+/* Get the background process the owner of the current slot chose, if there is time left of the slot */
+bool sched_get_background(uint64_t hartid, proc_t* prev, proc_t** proc)
+{
+    sched_background_t* entry = &background[hartid - MIN_HARTID][slot_owner[hartid - MIN_HARTID]];
+    cap_node_t* cn = entry->cn;
+    if (cn == NULL)
+        return false;
+    synchronize();
+    uint64_t pid = entry->pid;
+    /* The capability must still be a time capability of this hart, not being revoked */
+    cap_t cap = cap_node_get_cap(cn);
+    if (!cap_is_type(cap, CAP_TYPE_TIME) || cap_time_get_hartid(cap) != hartid)
+        return false;
+    /* Timer has expired, slot is over */
+    if (read_time() + scheduler_ticks >= read_timeout(hartid))
+        return false;
+    *proc = &processes[pid];
+    return *proc != prev && proc_acquire(*proc);
+}
+
 void sched_yield(void)
 {
+    uintptr_t hartid = read_csr(mhartid);
+    proc_t* prev = current;
+    proc_t* proc;
     proc_release(current);
+    /* Donate the rest of the slot to the background process */
+    if (sched_get_background(hartid, prev, &proc)) {
+        current = proc;
+#ifdef MEMORY_PROTECTION
+        proc_load_pmp(proc);
+#endif
+        trap_resume_proc();
+    }
     sched_start();
 }
 
+/*
+ * Switch directly to proc, which the caller has set running, for the rest of
+ * the current slot. The dispatcher is not involved.
+ */
+void sched_donate(proc_t* proc)
+{
+    uintptr_t hartid = read_csr(mhartid);
+    proc_release(current);
+    /* Slot is over, proc will be dispatched in its own slots */
+    if (read_time() + scheduler_ticks >= read_timeout(hartid)) {
+        proc_release(proc);
+        sched_start();
+    }
+    current = proc;
+#ifdef MEMORY_PROTECTION
+    proc_load_pmp(proc);
+#endif
+    trap_resume_proc();
+}
+
+bool sched_owns_slot(uint64_t hartid, proc_t* proc)
+{
+    return slot_owner[hartid - MIN_HARTID] == proc->pid && read_time() + scheduler_ticks < read_timeout(hartid);
+}
+
 void sched_start(void)
 {
     uintptr_t hartid = read_csr(mhartid);
     /* Process to run and number of time slices to run for */
     proc_t* proc;
-    uint64_t time, length, timeout, end_time;
+    uint64_t time, now, length, timeout, end_time;
+#ifdef SCHEDULER_CALIBRATE
+    uint64_t begin;
+#endif
 
     while (1) {
-        /* Get the current time */
-        time = (read_time() / TICKS) + 1;
-        /* Try getting a process at that time slice. */
-        if (!sched_get_proc(hartid, time, &proc, &length))
+#ifdef SCHEDULER_CALIBRATE
+        begin = sched_dispatch_begin(hartid);
+#endif
+        /* Get the next quantum */
+        now = (read_time() / TICKS) + 1;
+        time = now;
+        /* Try getting a process at the first valid slot. */
+        if (!sched_get_proc(hartid, &time, &proc, &length)) {
+            /* Nothing to run, sleep until next quantum */
+            sched_sleep(hartid, now * TICKS);
             continue;
+        }
+        /* Slot is later, sleep until it is next or the major frame ends */
+        if (time != now) {
+            if (time / N_QUANTUM != now / N_QUANTUM)
+                time = (now / N_QUANTUM + 1) * N_QUANTUM;
+            sched_sleep(hartid, (time - 1) * TICKS);
+            continue;
+        }
         timeout = proc->regs.timeout;
-        end_time = (time + length) * TICKS - SCHEDULER_TICKS;
+        end_time = (time + length) * TICKS - scheduler_ticks;
         if (timeout >= end_time) {
+            /* Process has yielded the slot, sleep until the slot ends */
+            sched_sleep(hartid, (time + length - 1) * TICKS);
             continue;
         }
         if (proc_acquire(proc))
             break;
+        /* Process is busy, sleep until next quantum */
+        sched_sleep(hartid, now * TICKS);
     }
     /* Wait for time slice to start and set timeout */
     current = proc;
+    slot_owner[hartid - MIN_HARTID] = proc->pid;
 #ifdef MEMORY_PROTECTION
     proc_load_pmp(proc);
+#endif
+#ifdef SCHEDULER_CALIBRATE
+    sched_measure(read_time() - begin);
 #endif
     wait_and_set_timeout(time, length, timeout);
     trap_resume_proc();
 }
 
+/* Get the shadow buffer, brought up to date after a publication. Requires lock. */
+sched_buffer_t* sched_shadow(void)
+{
+    sched_buffer_t* shadow = &buffers[(epoch + 1) % 2];
+    if (shadow_stale) {
+        *shadow = buffers[epoch % 2];
+        shadow_stale = false;
+    }
+    return shadow;
+}
+
 void sched_update(cap_node_t* cn, uint64_t hartid, uint64_t begin, uint64_t end, uint64_t pid)
 {
     kassert(begin < end);
@@ -131,9 +585,117 @@ void sched_update(cap_node_t* cn, uint64_t hartid, uint64_t begin, uint64_t end,
 
     lock_acquire(&lock);
     if (!cap_node_is_deleted(cn)) {
-        for (int i = begin; i < end; ++i) {
-            sched_set(i, hartid, pid, end - i);
-        }
+        sched_buffer_t* shadow = sched_shadow();
+        sched_table_t* owners = sched_owners(shadow, hartid);
+        /* Fits in the slots reserved for the live time capabilities */
+        sched_table_assign(&scratch, owners, begin, end, pid);
+        *owners = scratch;
+        /* Harts at or above hartid may have new conflicts */
+        for (uint64_t j = hartid; j <= MAX_HARTID; j++)
+            sched_table_resolve(shadow, j);
+        sched_mark_dirty();
+    }
+    lock_release(&lock);
+}
+
+/*
+ * Reserve the slots of a new time capability on hartid, so updates of the
+ * schedule never run out of slots. Fails if there is no room.
+ */
+bool sched_reserve(uint64_t hartid)
+{
+    kassert(MIN_HARTID <= hartid && hartid <= MAX_HARTID);
+    lock_acquire(&lock);
+    uint64_t h = hartid - MIN_HARTID;
+    live_caps[h]++;
+    bool reserved = sched_fits(live_caps, sched_masks(sched_shadow()->mode));
+    if (!reserved)
+        live_caps[h]--;
+    lock_release(&lock);
+    return reserved;
+}
+
+/* Free the slots of a deleted time capability on hartid */
+void sched_unreserve(uint64_t hartid)
+{
+    kassert(MIN_HARTID <= hartid && hartid <= MAX_HARTID);
+    lock_acquire(&lock);
+    live_caps[hartid - MIN_HARTID]--;
+    lock_release(&lock);
+}
+
+/* Only the owner of cn writes its entries, other harts only clear them */
+void sched_set_background(cap_node_t* cn, uint64_t hartid, uint64_t pid)
+{
+    kassert(MIN_HARTID <= hartid && hartid <= MAX_HARTID);
+    sched_background_t* entry = &background[hartid - MIN_HARTID][sched_node_pid(cn)];
+    if (pid >= N_PROC) {
+        entry->cn = NULL;
+        return;
+    }
+    entry->pid = pid;
+    synchronize();
+    entry->cn = cn;
+}
+
+void sched_clear_background(cap_node_t* cn)
+{
+    uint64_t owner = sched_node_pid(cn);
+    for (uint64_t hartid = MIN_HARTID; hartid <= MAX_HARTID; hartid++) {
+        sched_background_t* entry = &background[hartid - MIN_HARTID][owner];
+        if (entry->cn == cn)
+            (void)compare_and_swap(&entry->cn, cn, NULL);
+    }
+}
+
+/*
+ * Save the owner tables, the time the capabilities grant now, as a mode. If
+ * the mode is active, it is applied again at the next major frame, and the
+ * save fails if the slots reserved would not fit with it.
+ */
+bool sched_save_mode(uint64_t mode)
+{
+    bool saved = false;
+    if (mode >= N_SCHED_MODES)
+        return false;
+    lock_acquire(&lock);
+    sched_buffer_t* shadow = sched_shadow();
+    if (shadow->mode == mode && !sched_fits(live_caps, shadow->owners))
+        goto out;
+    for (uint64_t hartid = MIN_HARTID; hartid <= MAX_HARTID; hartid++)
+        modes[mode][hartid - MIN_HARTID] = *sched_owners(shadow, hartid);
+    mode_saved[mode] = true;
+    if (shadow->mode == mode) {
+        for (uint64_t hartid = MIN_HARTID; hartid <= MAX_HARTID; hartid++)
+            sched_table_resolve(shadow, hartid);
+        sched_mark_dirty();
+    }
+    saved = true;
+out:
+    lock_release(&lock);
+    return saved;
+}
+
+/*
+ * Switch to a saved mode, all harts change schedule at the next major frame.
+ * The mode masks the owner tables, which keep following the time
+ * capabilities, so it can drop time but never grant any, and switching back
+ * to a fuller mode restores the time it dropped.
+ */
+bool sched_load_mode(uint64_t mode)
+{
+    bool loaded = false;
+    if (mode >= N_SCHED_MODES)
+        return false;
+    lock_acquire(&lock);
+    sched_buffer_t* shadow = sched_shadow();
+    if (mode_saved[mode] && sched_fits(live_caps, modes[mode])) {
+        shadow->mode = mode;
+        for (uint64_t hartid = MIN_HARTID; hartid <= MAX_HARTID; hartid++)
+            sched_table_resolve(shadow, hartid);
+        sched_mark_dirty();
+        loaded = true;
     }
     lock_release(&lock);
+    return loaded;
 }
@@ -10,34 +10,81 @@
 #include "consts.h"
 #include "csr.h"
 #include "kprint.h"
-#include "lock.h"
 #include "preemption.h"
 #include "proc.h"
 #include "proc_state.h"
 #include "sched.h"
 #include "trap.h"
+#include "waitq.h"
 
 /*** INTERNAL FUNCTION DECLARATIONS ***/
+/* Capability operation of a batch, see syscall_batch */
+typedef struct batch_op {
+    uint64_t op;
+    uint64_t arg[4];
+    uint64_t status;
+} batch_op_t;
+
+/* Derive a capability, preemptible until it commits */
+static uint64_t derive_cap(uint64_t src_cidx, uint64_t dest_cidx, uint64_t word0, uint64_t word1);
+/* Run one operation of a batch */
+static uint64_t batch_run(batch_op_t* op);
 /* For moving capability between processes */
 static uint64_t interprocess_move(proc_t* src_proc, uint64_t src_cidx, proc_t* dest_proc, uint64_t dest_cidx);
 /* Hook used when capability is created, updated or moved. */
 static void cap_update_hook(proc_t* proc, cap_node_t* node, cap_t cap);
+/* Delete the children of node, revoked by proc, and hand their resources back to proc with node */
+static void revoke_walk(proc_t* proc, cap_node_t* node, cap_t cap);
+/* Finish the revoke proc has in progress, if any */
+static void revoke_finish(proc_t* proc);
 /* Returns update capability for after revoke */
 static cap_t revoke_update_cap(cap_t cap);
 /* Returns update capability for after deriving new_cap */
 static cap_t derive_update_cap(cap_t src_cap, cap_t new_cap);
+/* Set the receiver of channel to proc, of capability type type, unless node is deleted, returns true if set */
+static bool publish_receiver(uint64_t channel, cap_node_t* node, proc_t* proc, cap_type_t type);
+/* Reply to the client served on channel, returns the client if donate and it gets its donated slot back */
+static proc_t* reply_client(uint64_t channel, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3,
+                            uint64_t src_cidx, uint64_t len, bool donate);
+/* Send to the receiver waiting on channel, never blocks */
+static uint64_t sender_try_send(uint64_t channel, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3,
+                                uint64_t src_cidx, uint64_t flags, uint64_t len);
+/* Deliver a message to a receiver acquired by the sender and release it */
+static void sender_deliver(proc_t* receiver, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3,
+                           uint64_t src_cidx, uint64_t len);
+/* Copy len words from the IPC buffer of src to that of dest */
+static void ipc_copy(proc_t* src, proc_t* dest, uint64_t len);
+/* Take the message of the next client queued on channel, for the current server */
+static bool take_queued_client(uint64_t channel);
+/* Take the message of the next sender parked on channel, for the current receiver */
+static bool take_parked_sender(uint64_t channel);
+/* Fail the calls and sends of all processes queued on channel */
+static void reject_queued(uint64_t channel);
+
+static void notification_signal(uint64_t channel, uint64_t bits);
+
+static uint64_t notification_take(uint64_t channel);
 
 static uint64_t syscall_invoke_supervisor(cap_t cap, uint64_t pid, uint64_t op, uint64_t arg0, uint64_t arg1);
+static uint64_t syscall_invoke_time(cap_node_t* node, cap_t cap, uint64_t pid);
 static uint64_t syscall_invoke_receiver(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3);
 static uint64_t syscall_invoke_sender(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3,
-                                      uint64_t src_cidx);
+                                      uint64_t src_cidx, uint64_t flags, uint64_t len);
 static uint64_t syscall_invoke_server(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3,
-                                      uint64_t src_cidx, uint64_t flags);
+                                      uint64_t src_cidx, uint64_t flags, uint64_t len);
 static uint64_t syscall_invoke_client(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3,
-                                      uint64_t src_cidx);
+                                      uint64_t src_cidx, uint64_t donate, uint64_t len);
+static uint64_t syscall_invoke_notification(cap_t cap, uint64_t arg);
+static uint64_t syscall_invoke_multicast(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3,
+                                         uint64_t flags);
 
-static lock_t receivers_lock;
 static proc_t* receivers[N_CHANNELS][2];
+/* Capability type receivers[channel][0] was published with */
+static cap_type_t receiver_types[N_CHANNELS];
+/* Wake-ups latched by senders while the receiver was not waiting */
+static uint64_t doorbells[N_CHANNELS];
+/* Pending bits of notification channels */
+static uint64_t notifications[N_CHANNELS];
 
 /*** SYSTEM CALLS ***/
 
@@ -62,11 +109,15 @@ uint64_t syscall_move_cap(uint64_t src_cidx, uint64_t dest_cidx)
     cap_node_t* src_node = proc_get_cap_node(current, src_cidx);
     cap_t cap = cap_node_get_cap(src_node);
     cap_node_t* dest_node = proc_get_cap_node(current, dest_cidx);
-    if (cap_node_is_deleted(src_node))
+    if (cap_is_type(cap, CAP_TYPE_EMPTY))
         return ERROR_EMPTY;
     if (!cap_node_is_deleted(dest_node))
         return ERROR_COLLISION;
-    return cap_node_move(cap, src_node, dest_node) ? ERROR_OK : ERROR_EMPTY;
+    if (!cap_node_move(cap, src_node, dest_node))
+        return ERROR_EMPTY;
+    if (cap_is_type(cap, CAP_TYPE_TIME))
+        sched_clear_background(src_node);
+    return ERROR_OK;
 }
 
 uint64_t syscall_delete_cap(uint64_t cidx)
@@ -74,42 +125,33 @@ uint64_t syscall_delete_cap(uint64_t cidx)
     kassert(current != NULL);
     cap_node_t* node = proc_get_cap_node(current, cidx);
     cap_t cap = cap_node_get_cap(node);
-    if (cap_node_is_deleted(node) || !cap_node_delete(node))
+    /* A revoked node is left to the revoke, which hands its resources back */
+    if (cap_is_type(cap, CAP_TYPE_EMPTY))
         return ERROR_EMPTY;
     cap_update_hook(NULL, node, cap);
+    if (!cap_node_delete(node))
+        return ERROR_EMPTY;
+    if (cap_is_type(cap, CAP_TYPE_TIME))
+        sched_unreserve(cap_time_get_hartid(cap));
     return ERROR_OK;
 }
 
 uint64_t syscall_revoke_cap(uint64_t cidx)
 {
     kassert(current != NULL);
-    /* Return ERROR_PREEMPTED if preemted */
-    current->regs.a0 = ERROR_PREEMPTED;
-
-    /* !!! ENABLE PREEMPTION !!! */
-    preemption_enable();
-
     /* Get the current node and capability*/
     cap_node_t* node = proc_get_cap_node(current, cidx);
-    cap_t cap = node->cap;
+    cap_t cap = cap_node_get_cap(node);
 
-    if (!cap_node_is_deleted(node))
+    if (cap_is_type(cap, CAP_TYPE_EMPTY)) {
+        /* Deleted by the revoke of an ancestor, which reclaims what is left under its own fence */
+        cap_node_revoke_end(node, current->pid);
         return ERROR_EMPTY;
-
-    while (!cap_node_is_deleted(node)) {
-        cap_node_t* next_node = node->next;
-        cap_t next_cap = next_node->cap;
-        if (!cap_is_child(cap, next_cap))
-            break;
-        preemption_disable();
-        if (cap_node_delete2(next_node, node))
-            cap_update_hook(current, node, next_cap);
-        preemption_enable();
     }
 
-    preemption_disable();
-    node->cap = revoke_update_cap(cap);
-    cap_update_hook(current, node, cap);
+    /* The subtree reads as deleted from here on, the walk below reclaims it */
+    cap_node_revoke_begin(node, current->pid);
+    revoke_walk(current, node, cap);
     return ERROR_OK;
 }
 
@@ -118,7 +160,51 @@ uint64_t syscall_derive_cap(uint64_t src_cidx, uint64_t dest_cidx, uint64_t word
     kassert(current != NULL);
     /* If we get preempted, return ERROR_PREEMPTED */
     current->regs.a0 = ERROR_PREEMPTED;
+    return derive_cap(src_cidx, dest_cidx, word0, word1);
+}
 
+uint64_t syscall_batch(uint64_t ops, uint64_t n)
+{
+    kassert(current != NULL);
+    batch_op_t* op = (batch_op_t*)ops;
+    if (n == 0)
+        return ERROR_OK;
+    /* The operations are read and their status written in place */
+    if (ops % sizeof(uint64_t) != 0 || n >= (1ull << 32)
+        || !proc_has_access(current, ops, ops + n * sizeof(batch_op_t), 0x3))
+        return ERROR_FAILED;
+
+    /* If preempted, the ecall runs again on the remaining operations, a0 and a1 track them */
+    current->regs.pc -= 4;
+    while (n > 0) {
+        current->regs.a0 = (uint64_t)op;
+        current->regs.a1 = n;
+        /* An earlier operation may have removed the pmp capability covering the entry */
+        if (!proc_has_access(current, (uint64_t)op, (uint64_t)(op + 1), 0x3)) {
+            current->regs.pc += 4;
+            return ERROR_FAILED;
+        }
+        /* !!! ENABLE PREEMPTION !!! between operations */
+        preemption_enable();
+        uint64_t status = batch_run(op);
+        preemption_disable();
+        /* The operation may have removed the pmp capability covering its own entry */
+        if (!proc_has_access(current, (uint64_t)op, (uint64_t)(op + 1), 0x3)) {
+            current->regs.pc += 4;
+            current->regs.a1 = n - 1;
+            return ERROR_FAILED;
+        }
+        op->status = status;
+        op++;
+        n--;
+    }
+    current->regs.pc += 4;
+    current->regs.a1 = 0;
+    return ERROR_OK;
+}
+
+uint64_t derive_cap(uint64_t src_cidx, uint64_t dest_cidx, uint64_t word0, uint64_t word1)
+{
     /* !!! ENABLE PREEMPTION !!! */
     preemption_enable();
 
@@ -128,16 +214,23 @@ uint64_t syscall_derive_cap(uint64_t src_cidx, uint64_t dest_cidx, uint64_t word
     cap_t new_cap = (cap_t){word0, word1};
 
     /* Check if we can derive the capability */
-    if (cap_node_is_deleted(src_node))
+    if (cap_is_type(src_cap, CAP_TYPE_EMPTY))
         return ERROR_EMPTY;
     if (!cap_node_is_deleted(dest_node))
         return ERROR_COLLISION;
     if (!cap_can_derive(src_cap, new_cap))
         return ERROR_ILLEGAL_DERIVATION;
     preemption_disable();
-    src_node->cap = derive_update_cap(src_cap, new_cap);
+    /* Deleting, revoking or moving the new time capability never runs out of slots */
+    if (cap_is_type(new_cap, CAP_TYPE_TIME) && !sched_reserve(cap_time_get_hartid(new_cap)))
+        return ERROR_FAILED;
     cap_update_hook(current, src_node, new_cap);
-    return cap_node_insert(new_cap, dest_node, src_node) ? ERROR_OK : ERROR_EMPTY;
+    src_node->cap = derive_update_cap(src_cap, new_cap);
+    if (cap_node_insert(new_cap, dest_node, src_node))
+        return ERROR_OK;
+    if (cap_is_type(new_cap, CAP_TYPE_TIME))
+        sched_unreserve(cap_time_get_hartid(new_cap));
+    return ERROR_EMPTY;
 }
 
 static uint64_t syscall_invoke_supervisor(cap_t cap, uint64_t pid, uint64_t op, uint64_t arg3, uint64_t arg4);
@@ -154,6 +247,9 @@ uint64_t syscall_invoke_cap(uint64_t cidx, uint64_t arg1, uint64_t arg2, uint64_
         /* arg1 -> pid */
         /* arg2 -> op */
         return syscall_invoke_supervisor(cap, arg1, arg2, arg3, arg4);
+    case CAP_TYPE_TIME:
+        /* arg1 -> pid of the background process, none if >= N_PROC */
+        return syscall_invoke_time(node, cap, arg1);
     case CAP_TYPE_RECEIVER:
         /* arg1 -> cap destination */
         /* arg2-5 -> message */
@@ -161,16 +257,28 @@ uint64_t syscall_invoke_cap(uint64_t cidx, uint64_t arg1, uint64_t arg2, uint64_
     case CAP_TYPE_SENDER:
         /* arg1-4 -> message */
         /* arg5 -> cap to send */
-        return syscall_invoke_sender(cap, arg1, arg2, arg3, arg4, arg5);
+        /* arg6 -> SEND_FLAG_* */
+        /* arg7 -> words to copy from the IPC buffer */
+        return syscall_invoke_sender(cap, arg1, arg2, arg3, arg4, arg5, arg6, arg7);
     case CAP_TYPE_SERVER:
         /* arg1-4 -> message */
         /* arg5 -> cap to send */
         /* arg6 -> do receive */
-        return syscall_invoke_server(cap, arg1, arg2, arg3, arg4, arg5, arg6);
+        /* arg7 -> words to copy from the IPC buffer */
+        return syscall_invoke_server(cap, arg1, arg2, arg3, arg4, arg5, arg6, arg7);
     case CAP_TYPE_CLIENT:
         /* arg1-4 -> message */
         /* arg5 -> cap to send */
-        return syscall_invoke_client(cap, arg1, arg2, arg3, arg4, arg5);
+        /* arg6 -> donate the rest of the slot to the server */
+        /* arg7 -> words to copy from the IPC buffer */
+        return syscall_invoke_client(cap, arg1, arg2, arg3, arg4, arg5, arg6, arg7);
+    case CAP_TYPE_NOTIFICATION:
+        /* arg1 -> bits to signal, or if receiving, wait for bits if non-zero */
+        return syscall_invoke_notification(cap, arg1);
+    case CAP_TYPE_MULTICAST:
+        /* arg1-4 -> message */
+        /* arg5 -> SEND_FLAG_LATCH or 0 */
+        return syscall_invoke_multicast(cap, arg1, arg2, arg3, arg4, arg5);
     default:
         return ERROR_UNIMPLEMENTED;
     }
@@ -208,6 +316,8 @@ uint64_t syscall_invoke_supervisor(cap_t cap, uint64_t pid, uint64_t op, uint64_
         return ERROR_OK;
     }
     case ECALL_SUP_WRITE_REG: { /* Write register */
+        /* The supervisee may no longer run its revoke again */
+        revoke_finish(supervisee);
         if (!proc_supervisor_acquire(supervisee))
             return ERROR_SUPERVISEE_BUSY;
         /* arg0 -> register number */
@@ -227,6 +337,8 @@ uint64_t syscall_invoke_supervisor(cap_t cap, uint64_t pid, uint64_t op, uint64_
         return ERROR_OK;
     }
     case ECALL_SUP_GIVE_CAP: { /* Give capability */
+        /* The slot of the revoked capability may be given a new one */
+        revoke_finish(supervisee);
         if (!proc_supervisor_acquire(supervisee))
             return ERROR_SUPERVISEE_BUSY;
         uint64_t code = interprocess_move(current, arg0, supervisee, arg1);
@@ -234,96 +346,267 @@ uint64_t syscall_invoke_supervisor(cap_t cap, uint64_t pid, uint64_t op, uint64_
         return code;
     }
     case ECALL_SUP_TAKE_CAP: { /* Take capability */
+        /* The revoked capability may be taken */
+        revoke_finish(supervisee);
         if (!proc_supervisor_acquire(supervisee))
             return ERROR_SUPERVISEE_BUSY;
         uint64_t code = interprocess_move(supervisee, arg0, current, arg1);
         proc_supervisor_release(supervisee);
         return code;
     }
+    case ECALL_SUP_SAVE_MODE: { /* Save schedule as mode */
+        /* Modes assign time to any process, requires supervision of all processes */
+        if (cap_supervisor_get_free(cap) != 0 || cap_supervisor_get_end(cap) != N_PROC)
+            return ERROR_INVALID_SUPERVISEE;
+        /* arg0 -> mode */
+        return sched_save_mode(arg0) ? ERROR_OK : ERROR_FAILED;
+    }
+    case ECALL_SUP_LOAD_MODE: { /* Switch schedule to mode */
+        if (cap_supervisor_get_free(cap) != 0 || cap_supervisor_get_end(cap) != N_PROC)
+            return ERROR_INVALID_SUPERVISEE;
+        /* arg0 -> mode */
+        return sched_load_mode(arg0) ? ERROR_OK : ERROR_FAILED;
+    }
     default: { /* No matching operation. */
         return ERROR_UNIMPLEMENTED;
     }
     }
 }
 
+uint64_t syscall_invoke_time(cap_node_t* node, cap_t cap, uint64_t pid)
+{
+    kassert(cap_is_type(cap, CAP_TYPE_TIME));
+    /* Run pid in the time the current process yields of its slots on the hart */
+    sched_set_background(node, cap_time_get_hartid(cap), pid);
+    return ERROR_OK;
+}
+
 uint64_t syscall_invoke_receiver(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3)
 {
     kassert(cap_is_type(cap, CAP_TYPE_RECEIVER));
     uint64_t channel = cap_receiver_get_channel(cap);
-    proc_receiver_wait(current, channel);
+    do {
+        /* Take the message of a parked sender without waiting */
+        if (take_parked_sender(channel))
+            return ERROR_OK;
+        if (!proc_receiver_wait(current, channel))
+            sched_yield();
+        /* Wait first, so a sender either finds us waiting or latched before we check */
+        synchronize();
+        if (doorbells[channel] != 0 && fetch_and_set(&doorbells[channel], 0) != 0
+            && proc_receiver_cancel(current, channel)) {
+            /* Woken by a latched sender, the message is empty */
+            current->regs.a1 = 0;
+            current->regs.a2 = 0;
+            current->regs.a3 = 0;
+            current->regs.a4 = 0;
+            return ERROR_OK;
+        }
+        /* A sender may have parked before we started waiting */
+    } while (!waitq_is_empty(channel) && proc_receiver_cancel(current, channel));
     sched_yield(); /* sched_yield does not return */
 }
 
-uint64_t syscall_invoke_sender(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t src_cidx)
+uint64_t syscall_invoke_sender(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t src_cidx,
+                               uint64_t flags, uint64_t len)
 {
     kassert(cap_is_type(cap, CAP_TYPE_SENDER));
     uint64_t channel = cap_sender_get_channel(cap);
+    uint64_t code = sender_try_send(channel, msg0, msg1, msg2, msg3, src_cidx, flags, len);
+    if (code != ERROR_NO_RECEIVER || (flags & (SEND_FLAG_LATCH | SEND_FLAG_NONBLOCK)))
+        return code;
     proc_t* receiver = receivers[channel][0];
-    if (receiver == NULL || !proc_sender_acquire(receiver, channel))
+    if (receiver == NULL)
         return ERROR_NO_RECEIVER;
-    if (src_cidx < N_CAPS && receiver->regs.dest_cidx < N_CAPS)
-        interprocess_move(current, src_cidx, receiver, receiver->regs.dest_cidx);
-    receiver->regs.a0 = ERROR_OK;
-    receiver->regs.a1 = msg0;
-    receiver->regs.a2 = msg1;
-    receiver->regs.a3 = msg2;
-    receiver->regs.a4 = msg3;
-    proc_sender_release(receiver);
+    /* Park on the channel, the receiver takes the message when it receives */
+    current->regs.a0 = ERROR_INTERRUPTED;
+    if (!proc_sender_wait(current, channel))
+        sched_yield();
+    waitq_push(channel, current);
+    synchronize();
+    /* The receiver was deleted or revoked before the push, so it never rejects us */
+    if (receivers[channel][0] != receiver) {
+        if (proc_sender_cancel(current, channel))
+            return ERROR_NO_RECEIVER;
+        sched_yield();
+    }
+    /* The receiver may have started waiting before the push */
+    if (!proc_sender_acquire(receiver, channel))
+        sched_yield();
+    /* Fails if the receiver took the message meanwhile, it keeps waiting for the next */
+    if (!proc_sender_cancel(current, channel)) {
+        proc_sender_unacquire(receiver, channel);
+        sched_yield();
+    }
+    sender_deliver(receiver, msg0, msg1, msg2, msg3, src_cidx, len);
     return ERROR_OK;
 }
 
 uint64_t syscall_invoke_server(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t src_cidx,
-                               uint64_t do_receive)
+                               uint64_t do_receive, uint64_t len)
 {
     kassert(cap_is_type(cap, CAP_TYPE_SERVER));
     uint64_t channel = cap_server_get_channel(cap);
-    /* Get a client waiting on reply */
-    proc_t* client = receivers[channel][1];
-    if (client != NULL && proc_sender_acquire(client, channel)) {
-        if (src_cidx < N_CAPS && client->regs.dest_cidx < N_CAPS)
-            interprocess_move(current, src_cidx, client, client->regs.dest_cidx);
-        client->regs.a0 = ERROR_OK;
-        client->regs.a1 = msg0;
-        client->regs.a2 = msg1;
-        client->regs.a3 = msg2;
-        client->regs.a4 = msg3;
-        proc_sender_release(client);
-    }
+    proc_t* donor = reply_client(channel, msg0, msg1, msg2, msg3, src_cidx, len, true);
 
-    /* Place the thread in waiting at channel */
-    proc_receiver_wait(current, channel);
+    do {
+        /* Serve the next queued client without waiting */
+        if (donor == NULL && take_queued_client(channel))
+            return ERROR_OK;
+        /* Place the thread in waiting at channel */
+        proc_receiver_wait(current, channel);
+        synchronize();
+        /* A client may have queued before we started waiting */
+    } while (donor == NULL && !waitq_is_empty(channel) && proc_receiver_cancel(current, channel));
+    if (donor != NULL)
+        sched_donate(donor);
     /* Yield */
     sched_yield();
 }
 
-uint64_t syscall_invoke_client(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t src_cidx)
+uint64_t syscall_invoke_client(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t src_cidx,
+                               uint64_t donate, uint64_t len)
 {
     kassert(cap_is_type(cap, CAP_TYPE_CLIENT));
     uint64_t channel = cap_client_get_channel(cap);
     proc_t* server = receivers[channel][0];
-    if (server == NULL || !proc_sender_acquire(server, channel))
+    if (server == NULL)
         return ERROR_NO_RECEIVER;
+    /* If the thread is not waiting, it was interrupted */
+    current->regs.a0 = ERROR_INTERRUPTED;
+
+    if (!proc_sender_acquire(server, channel)) {
+        /* Server is busy, queue up, it takes the message when it is done */
+        if (!proc_client_wait(current, channel))
+            sched_yield();
+        waitq_push(channel, current);
+        synchronize();
+        /* The server was deleted or revoked before the push, so it never rejects us */
+        if (receivers[channel][0] != server) {
+            if (proc_sender_cancel(current, channel))
+                return ERROR_NO_RECEIVER;
+            sched_yield();
+        }
+        /* The server may have started waiting before the push */
+        if (!proc_sender_acquire(server, channel))
+            sched_yield();
+        /* Fails if the server took the message meanwhile, it keeps waiting for the next */
+        if (!proc_caller_take(current, channel)) {
+            proc_sender_unacquire(server, channel);
+            sched_yield();
+        }
+    } else {
+        /* Place the thread in waiting at channel */
+        proc_receiver_wait(current, channel);
+    }
 
     if (src_cidx < N_CAPS && server->regs.dest_cidx < N_CAPS)
         interprocess_move(current, src_cidx, server, server->regs.dest_cidx);
+    ipc_copy(current, server, len);
     server->regs.a0 = ERROR_OK;
     server->regs.a1 = msg0;
     server->regs.a2 = msg1;
     server->regs.a3 = msg2;
     server->regs.a4 = msg3;
 
-    /* Subscribe to replies in channel */
-    compare_and_swap(&receivers[channel][1], NULL, current);
-    /* Place the thread in waiting at channel */
-    proc_receiver_wait(current, channel);
-    /* If the thread is not waiting, it was interrupted */
-    current->regs.a0 = ERROR_INTERRUPTED;
+    /* Subscribe to the reply */
+    receivers[channel][1] = current;
+    /* Switch straight to the server, its reply switches back */
+    if (donate) {
+        server->client = current;
+        if (proc_sender_switch(server, channel))
+            sched_donate(server);
+        server->client = NULL;
+    }
     /* Release the server */
     proc_sender_release(server);
     /* Yield */
     sched_yield();
 }
 
+uint64_t syscall_invoke_multicast(cap_t cap, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t flags)
+{
+    kassert(cap_is_type(cap, CAP_TYPE_MULTICAST));
+    uint64_t end = cap_multicast_get_end(cap);
+    uint64_t delivered = 0;
+    bool latched = false;
+    /* Deliver to every waiting receiver of the group, never blocks */
+    for (uint64_t channel = cap_multicast_get_begin(cap); channel < end; channel++) {
+        proc_t* receiver = receivers[channel][0];
+        /* Servers and notification waiters of the range are not part of the group */
+        if (receiver == NULL || receiver_types[channel] != CAP_TYPE_RECEIVER)
+            continue;
+        if (!proc_sender_acquire(receiver, channel)) {
+            if (!(flags & SEND_FLAG_LATCH))
+                continue;
+            /* Latch a wake-up, the receiver gets an empty message at its next receive */
+            doorbells[channel] = 1;
+            latched = true;
+            synchronize();
+            if (!proc_sender_acquire(receiver, channel))
+                continue;
+        }
+        /* A server or notification capability was published meanwhile, leave it waiting */
+        if (receivers[channel][0] != receiver || receiver_types[channel] != CAP_TYPE_RECEIVER) {
+            proc_sender_unacquire(receiver, channel);
+            continue;
+        }
+        receiver->regs.a0 = ERROR_OK;
+        receiver->regs.a1 = msg0;
+        receiver->regs.a2 = msg1;
+        receiver->regs.a3 = msg2;
+        receiver->regs.a4 = msg3;
+        proc_sender_release(receiver);
+        delivered++;
+    }
+    /* Number of receivers that got the message */
+    current->regs.a1 = delivered;
+    return (delivered > 0 || latched) ? ERROR_OK : ERROR_NO_RECEIVER;
+}
+
+uint64_t syscall_call(uint64_t cidx, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t no_cidx,
+                      uint64_t donate, uint64_t len)
+{
+    cap_t cap = proc_get_cap(current, cidx);
+    if (!cap_is_type(cap, CAP_TYPE_CLIENT))
+        return cap_is_type(cap, CAP_TYPE_EMPTY) ? ERROR_EMPTY : ERROR_UNIMPLEMENTED;
+    /* A queued client is served from its registers, clear a5 so neither path sends a capability */
+    current->regs.a5 = N_CAPS;
+    return syscall_invoke_client(cap, msg0, msg1, msg2, msg3, N_CAPS, donate, len);
+}
+
+uint64_t syscall_reply_recv(uint64_t cidx, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t len)
+{
+    cap_t cap = proc_get_cap(current, cidx);
+    if (!cap_is_type(cap, CAP_TYPE_SERVER))
+        return cap_is_type(cap, CAP_TYPE_EMPTY) ? ERROR_EMPTY : ERROR_UNIMPLEMENTED;
+    /* No capability to send */
+    return syscall_invoke_server(cap, msg0, msg1, msg2, msg3, N_CAPS, true, len);
+}
+
+uint64_t syscall_invoke_notification(cap_t cap, uint64_t arg)
+{
+    kassert(cap_is_type(cap, CAP_TYPE_NOTIFICATION));
+    uint64_t channel = cap_notification_get_channel(cap);
+    if (!cap_notification_get_receive(cap)) {
+        notification_signal(channel, arg);
+        return ERROR_OK;
+    }
+    /* Poll, or wait if nothing is pending */
+    current->regs.a1 = notification_take(channel);
+    if (current->regs.a1 != 0 || !arg)
+        return ERROR_OK;
+    if (!proc_receiver_wait(current, channel))
+        sched_yield();
+    /* Wait first, so a signaller either finds us waiting or sees its bits taken here */
+    synchronize();
+    if (notifications[channel] != 0 && proc_receiver_cancel(current, channel)) {
+        current->regs.a1 = notification_take(channel);
+        return ERROR_OK;
+    }
+    sched_yield();
+}
+
 uint64_t syscall_get_pid(void)
 {
     return current->pid;
@@ -346,6 +629,94 @@ void syscall_yield(void)
     sched_yield();
 }
 
+/*** FAST SYSTEM CALLS ***/
+
+bool syscall_fast_read_cap(uint64_t cidx)
+{
+    current->regs.a0 = syscall_read_cap(cidx);
+    return true;
+}
+
+bool syscall_fast_invoke_cap(uint64_t cidx, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5,
+                             uint64_t arg6, uint64_t arg7)
+{
+    cap_t cap = proc_get_cap(current, cidx);
+    switch (cap_get_type(cap)) {
+    case CAP_TYPE_EMPTY:
+        current->regs.a0 = ERROR_EMPTY;
+        return true;
+    case CAP_TYPE_SENDER: {
+        uint64_t code = sender_try_send(cap_sender_get_channel(cap), arg1, arg2, arg3, arg4, arg5, arg6, arg7);
+        /* A blocking send without a waiting receiver parks on the slow path, which reloads a0 */
+        if (code == ERROR_NO_RECEIVER && !(arg6 & (SEND_FLAG_LATCH | SEND_FLAG_NONBLOCK)))
+            return false;
+        current->regs.a0 = code;
+        return true;
+    }
+    case CAP_TYPE_NOTIFICATION: {
+        uint64_t channel = cap_notification_get_channel(cap);
+        if (!cap_notification_get_receive(cap)) {
+            notification_signal(channel, arg1);
+            current->regs.a0 = ERROR_OK;
+            return true;
+        }
+        /* Take the pending bits in one step, waiting without any blocks on the slow path */
+        uint64_t bits = notification_take(channel);
+        if (bits == 0 && arg1)
+            return false;
+        current->regs.a0 = ERROR_OK;
+        current->regs.a1 = bits;
+        return true;
+    }
+    case CAP_TYPE_MULTICAST:
+        /* Never blocks */
+        current->regs.a0 = syscall_invoke_multicast(cap, arg1, arg2, arg3, arg4, arg5);
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool syscall_fast_reply_recv(uint64_t cidx, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t len)
+{
+    cap_t cap = proc_get_cap(current, cidx);
+    /* A donated call switches back to the client on the slow path */
+    if (!cap_is_type(cap, CAP_TYPE_SERVER) || current->client != NULL)
+        return false;
+    uint64_t channel = cap_server_get_channel(cap);
+    if (waitq_is_empty(channel))
+        return false;
+    reply_client(channel, msg0, msg1, msg2, msg3, N_CAPS, len, false);
+    /* The reply is done, the slow path only waits for the next client */
+    if (!take_queued_client(channel))
+        return false;
+    current->regs.a0 = ERROR_OK;
+    return true;
+}
+
+bool syscall_fast_get_pid(void)
+{
+    current->regs.a0 = syscall_get_pid();
+    return true;
+}
+
+/* Only virtual registers, s0-s11 and pc in regs are stale on the fast path */
+bool syscall_fast_read_reg(uint64_t regnr)
+{
+    if (regnr < offsetof(regs_t, pmp) / sizeof(uint64_t))
+        return false;
+    current->regs.a0 = syscall_read_reg(regnr);
+    return true;
+}
+
+bool syscall_fast_write_reg(uint64_t regnr, uint64_t val)
+{
+    if (regnr < offsetof(regs_t, pmp) / sizeof(uint64_t))
+        return false;
+    current->regs.a0 = syscall_write_reg(regnr, val);
+    return true;
+}
+
 /*** INTERNAL FUNCTIONS ***/
 
 uint64_t interprocess_move(proc_t* src_proc, uint64_t src_cidx, proc_t* dest_proc, uint64_t dest_cidx)
@@ -353,7 +724,7 @@ uint64_t interprocess_move(proc_t* src_proc, uint64_t src_cidx, proc_t* dest_pro
     cap_node_t* src_node = proc_get_cap_node(src_proc, src_cidx);
     cap_t cap = cap_node_get_cap(src_node);
     cap_node_t* dest_node = proc_get_cap_node(dest_proc, dest_cidx);
-    if (cap_node_is_deleted(src_node))
+    if (cap_is_type(cap, CAP_TYPE_EMPTY))
         return ERROR_EMPTY;
     if (!cap_node_is_deleted(dest_node))
         return ERROR_COLLISION;
@@ -368,30 +739,276 @@ void cap_update_hook(proc_t* proc, cap_node_t* node, cap_t cap)
         uint64_t free = cap_time_get_free(cap);
         uint64_t end = cap_time_get_end(cap);
         uint64_t pid = (proc != NULL) ? proc->pid : INVALID_PID;
+        /* Deleted or moved to another process, the background process set with it is dropped */
+        if (proc == NULL || node < proc->cap_table || node >= proc->cap_table + N_CAPS)
+            sched_clear_background(node);
         sched_update(node, hartid, free, end, pid);
     }
     if (cap_is_type(cap, CAP_TYPE_RECEIVER)) {
         uint64_t channel = cap_receiver_get_channel(cap);
-        lock_acquire(&receivers_lock);
-        if (!cap_node_is_deleted(node)) {
-            receivers[channel][0] = proc;
-            if (proc == NULL)
+        if (publish_receiver(channel, node, proc, cap_get_type(cap))) {
+            doorbells[channel] = 0;
+            if (proc == NULL) {
                 receivers[channel][1] = NULL;
+                reject_queued(channel);
+            }
         }
-        lock_release(&receivers_lock);
     }
     if (cap_is_type(cap, CAP_TYPE_SERVER)) {
         uint64_t channel = cap_server_get_channel(cap);
-        lock_acquire(&receivers_lock);
-        if (!cap_node_is_deleted(node)) {
-            receivers[channel][0] = proc;
-            if (proc == NULL)
-                receivers[channel][1] = NULL;
+        if (publish_receiver(channel, node, proc, cap_get_type(cap)) && proc == NULL) {
+            receivers[channel][1] = NULL;
+            reject_queued(channel);
         }
-        lock_release(&receivers_lock);
+    }
+    if (cap_is_type(cap, CAP_TYPE_NOTIFICATION) && cap_notification_get_receive(cap)) {
+        uint64_t channel = cap_notification_get_channel(cap);
+        if (publish_receiver(channel, node, proc, cap_get_type(cap)) && proc == NULL)
+            notifications[channel] = 0;
     }
 }
 
+/*
+ * Runs with preemption enabled between children. If preempted, the ecall of
+ * current runs again when it resumes. Deleted children are unlinked, so
+ * node->next is always the next to delete and the walk continues where it
+ * stopped. Also safe while another process walks the same node.
+ */
+void revoke_walk(proc_t* proc, cap_node_t* node, cap_t cap)
+{
+    current->regs.pc -= 4;
+
+    /* !!! ENABLE PREEMPTION !!! */
+    preemption_enable();
+
+    while (!cap_node_is_deleted(node)) {
+        cap_node_t* next_node = node->next;
+        cap_t next_cap = next_node->cap;
+        if (!cap_is_child(cap, next_cap))
+            break;
+        preemption_disable();
+        /* Release the resources as delete does */
+        cap_update_hook(NULL, next_node, next_cap);
+        if (cap_node_delete2(next_node, node) && cap_is_type(next_cap, CAP_TYPE_TIME))
+            sched_unreserve(cap_time_get_hartid(next_cap));
+        preemption_enable();
+    }
+
+    preemption_disable();
+    current->regs.pc += 4;
+    node->cap = revoke_update_cap(cap);
+    /* The time released by the children goes back to proc with the rest of the node */
+    cap_update_hook(proc, node, node->cap);
+    cap_node_revoke_end(node, proc->pid);
+}
+
+void revoke_finish(proc_t* proc)
+{
+    cap_node_t* node = cap_revoking[proc->pid];
+    if (node == NULL)
+        return;
+    cap_t cap = cap_node_get_cap(node);
+    if (cap_is_type(cap, CAP_TYPE_EMPTY))
+        cap_node_revoke_end(node, proc->pid);
+    else
+        revoke_walk(proc, node, cap);
+}
+
+uint64_t batch_run(batch_op_t* op)
+{
+    uint64_t code;
+    switch (op->op) {
+    case BATCH_OP_DERIVE:
+        return derive_cap(op->arg[0], op->arg[1], op->arg[2], op->arg[3]);
+    case BATCH_OP_MOVE:
+        preemption_disable();
+        return syscall_move_cap(op->arg[0], op->arg[1]);
+    case BATCH_OP_DELETE:
+        preemption_disable();
+        return syscall_delete_cap(op->arg[0]);
+    case BATCH_OP_GIVE:
+    case BATCH_OP_TAKE: {
+        preemption_disable();
+        cap_t cap = proc_get_cap(current, op->arg[0]);
+        if (!cap_is_type(cap, CAP_TYPE_SUPERVISOR))
+            return cap_is_type(cap, CAP_TYPE_EMPTY) ? ERROR_EMPTY : ERROR_UNIMPLEMENTED;
+        code = (op->op == BATCH_OP_GIVE) ? ECALL_SUP_GIVE_CAP : ECALL_SUP_TAKE_CAP;
+        return syscall_invoke_supervisor(cap, op->arg[1], code, op->arg[2], op->arg[3]);
+    }
+    default:
+        return ERROR_UNIMPLEMENTED;
+    }
+}
+
+bool publish_receiver(uint64_t channel, cap_node_t* node, proc_t* proc, cap_type_t type)
+{
+    /* Per channel, updates of other channels never contend */
+    proc_t* old;
+    /* The type is set first, so whoever finds proc published finds its type */
+    if (proc != NULL) {
+        receiver_types[channel] = type;
+        synchronize();
+    }
+    do {
+        old = receivers[channel][0];
+        if (cap_node_is_deleted(node))
+            return false;
+    } while (!compare_and_set(&receivers[channel][0], old, proc));
+    return true;
+}
+
+proc_t* reply_client(uint64_t channel, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t src_cidx,
+                     uint64_t len, bool donate)
+{
+    /* Get the client waiting on reply */
+    proc_t* client = receivers[channel][1];
+    proc_t* donor = NULL;
+    if (client != NULL && proc_sender_acquire(client, channel)) {
+        receivers[channel][1] = NULL;
+        if (src_cidx < N_CAPS && client->regs.dest_cidx < N_CAPS)
+            interprocess_move(current, src_cidx, client, client->regs.dest_cidx);
+        ipc_copy(current, client, len);
+        client->regs.a0 = ERROR_OK;
+        client->regs.a1 = msg0;
+        client->regs.a2 = msg1;
+        client->regs.a3 = msg2;
+        client->regs.a4 = msg3;
+        /*
+         * Give the donated slot back to the client, unless other clients are
+         * queued. If the slot ended meanwhile, this is some other slot.
+         */
+        if (donate && current->client == client && waitq_is_empty(channel)
+            && sched_owns_slot(read_csr(mhartid), client) && proc_sender_switch(client, channel))
+            donor = client;
+        else
+            proc_sender_release(client);
+        if (current->client == client)
+            current->client = NULL;
+    }
+    return donor;
+}
+
+uint64_t sender_try_send(uint64_t channel, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3,
+                         uint64_t src_cidx, uint64_t flags, uint64_t len)
+{
+    proc_t* receiver = receivers[channel][0];
+    if (receiver == NULL)
+        return ERROR_NO_RECEIVER;
+    if (!proc_sender_acquire(receiver, channel)) {
+        if (!(flags & SEND_FLAG_LATCH))
+            return ERROR_NO_RECEIVER;
+        /* Latch the wake-up, then retry in case the receiver started waiting meanwhile */
+        doorbells[channel] = 1;
+        synchronize();
+        if (!proc_sender_acquire(receiver, channel))
+            return ERROR_OK;
+    }
+    sender_deliver(receiver, msg0, msg1, msg2, msg3, src_cidx, len);
+    return ERROR_OK;
+}
+
+void sender_deliver(proc_t* receiver, uint64_t msg0, uint64_t msg1, uint64_t msg2, uint64_t msg3, uint64_t src_cidx,
+                    uint64_t len)
+{
+    if (src_cidx < N_CAPS && receiver->regs.dest_cidx < N_CAPS)
+        interprocess_move(current, src_cidx, receiver, receiver->regs.dest_cidx);
+    ipc_copy(current, receiver, len);
+    receiver->regs.a0 = ERROR_OK;
+    receiver->regs.a1 = msg0;
+    receiver->regs.a2 = msg1;
+    receiver->regs.a3 = msg2;
+    receiver->regs.a4 = msg3;
+    proc_sender_release(receiver);
+}
+
+void ipc_copy(proc_t* src, proc_t* dest, uint64_t len)
+{
+    /* Word 0 of the receiving buffer gets the number of words copied after it */
+    uint64_t* dest_buf = proc_get_ipc_buffer(dest, 0x2);
+    if (dest_buf == NULL)
+        return;
+    uint64_t* src_buf = proc_get_ipc_buffer(src, 0x1);
+    if (src_buf == NULL)
+        len = 0;
+    else if (len > N_IPC_WORDS)
+        len = N_IPC_WORDS;
+    for (uint64_t i = 1; i <= len; i++)
+        dest_buf[i] = src_buf[i];
+    dest_buf[0] = len;
+}
+
+bool take_queued_client(uint64_t channel)
+{
+    proc_t* client;
+    while ((client = waitq_pop(channel)) != NULL) {
+        /* Skip clients no longer waiting */
+        if (!proc_caller_take(client, channel))
+            continue;
+        /* The message and cap to send are still in the client's registers */
+        if (client->regs.a5 < N_CAPS && current->regs.dest_cidx < N_CAPS)
+            interprocess_move(client, client->regs.a5, current, current->regs.dest_cidx);
+        ipc_copy(client, current, client->regs.a7);
+        current->regs.a1 = client->regs.a1;
+        current->regs.a2 = client->regs.a2;
+        current->regs.a3 = client->regs.a3;
+        current->regs.a4 = client->regs.a4;
+        receivers[channel][1] = client;
+        return true;
+    }
+    return false;
+}
+
+bool take_parked_sender(uint64_t channel)
+{
+    proc_t* sender;
+    while ((sender = waitq_pop(channel)) != NULL) {
+        /* Skip senders no longer parked */
+        if (!proc_caller_acquire(sender, channel))
+            continue;
+        /* The message and cap to send are still in the sender's registers */
+        if (sender->regs.a5 < N_CAPS && current->regs.dest_cidx < N_CAPS)
+            interprocess_move(sender, sender->regs.a5, current, current->regs.dest_cidx);
+        ipc_copy(sender, current, sender->regs.a7);
+        current->regs.a1 = sender->regs.a1;
+        current->regs.a2 = sender->regs.a2;
+        current->regs.a3 = sender->regs.a3;
+        current->regs.a4 = sender->regs.a4;
+        sender->regs.a0 = ERROR_OK;
+        proc_sender_release(sender);
+        return true;
+    }
+    return false;
+}
+
+void reject_queued(uint64_t channel)
+{
+    proc_t* proc;
+    while ((proc = waitq_pop(channel)) != NULL) {
+        if (proc_caller_acquire(proc, channel)) {
+            proc->regs.a0 = ERROR_NO_RECEIVER;
+            proc_sender_release(proc);
+        }
+    }
+}
+
+/* Set bits on the channel and wake its waiter with them, never blocks */
+void notification_signal(uint64_t channel, uint64_t bits)
+{
+    fetch_and_or(&notifications[channel], bits);
+    proc_t* receiver = receivers[channel][0];
+    if (receiver != NULL && proc_sender_acquire(receiver, channel)) {
+        receiver->regs.a0 = ERROR_OK;
+        receiver->regs.a1 = notification_take(channel);
+        proc_sender_release(receiver);
+    }
+}
+
+/* Take the pending bits of the channel, 0 if none */
+uint64_t notification_take(uint64_t channel)
+{
+    return fetch_and_set(&notifications[channel], 0);
+}
+
 cap_t revoke_update_cap(cap_t cap)
 {
     switch (cap_get_type(cap)) {
@@ -400,7 +1017,7 @@ cap_t revoke_update_cap(cap_t cap)
     case CAP_TYPE_TIME:
         return cap_time_set_free(cap, cap_time_get_begin(cap));
     case CAP_TYPE_CHANNELS:
-        return cap_time_set_free(cap, cap_time_get_begin(cap));
+        return cap_channels_set_free(cap, cap_channels_get_begin(cap));
     case CAP_TYPE_SUPERVISOR:
         return cap_supervisor_set_free(cap, cap_supervisor_get_begin(cap));
     default:
@@ -425,12 +1042,20 @@ cap_t derive_update_cap(cap_t src_cap, cap_t new_cap)
             return cap_channels_set_free(src_cap, cap_receiver_get_channel(new_cap) + 1);
         else if (cap_is_type(new_cap, CAP_TYPE_SERVER))
             return cap_channels_set_free(src_cap, cap_server_get_channel(new_cap) + 1);
+        else if (cap_is_type(new_cap, CAP_TYPE_NOTIFICATION))
+            return cap_channels_set_free(src_cap, cap_notification_get_channel(new_cap) + 1);
+        else if (cap_is_type(new_cap, CAP_TYPE_MULTICAST))
+            return src_cap;
         else
             kassert(0);
     case CAP_TYPE_RECEIVER:
         return src_cap;
     case CAP_TYPE_SERVER:
         return src_cap;
+    case CAP_TYPE_NOTIFICATION:
+        return src_cap;
+    case CAP_TYPE_MULTICAST:
+        return src_cap;
     case CAP_TYPE_SUPERVISOR:
         return cap_supervisor_set_free(src_cap, cap_supervisor_get_end(new_cap));
     default:
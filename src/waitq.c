@@ -0,0 +1,51 @@
+// See LICENSE file for copyright and license details.
+#include "waitq.h"
+
+#include <stddef.h>
+
+#include "atomic.h"
+#include "kassert.h"
+
+_Static_assert(N_PROC <= 64, "Wait queues hold one bit per process");
+
+/* Bit pid is set if process pid is queued on the channel */
+static volatile uint64_t queued[N_CHANNELS];
+#ifndef WAITQ_PRIORITY
+/* Next arrival ticket of each channel */
+static uint64_t tickets[N_CHANNELS];
+#endif
+
+void waitq_push(uint64_t channel, proc_t* proc)
+{
+    kassert(channel < N_CHANNELS);
+#ifndef WAITQ_PRIORITY
+    proc->ticket = fetch_and_add(&tickets[channel], 1);
+    synchronize();
+#endif
+    fetch_and_or(&queued[channel], 1ull << proc->pid);
+}
+
+/* Pop the earliest arrival, or the lowest pid with WAITQ_PRIORITY */
+proc_t* waitq_pop(uint64_t channel)
+{
+    kassert(channel < N_CHANNELS);
+    uint64_t mask = queued[channel];
+    if (mask == 0)
+        return NULL;
+    uint64_t pid = __builtin_ctzll(mask);
+#ifndef WAITQ_PRIORITY
+    for (uint64_t i = pid + 1; i < N_PROC; i++) {
+        if ((mask & (1ull << i)) && processes[i].ticket < processes[pid].ticket)
+            pid = i;
+    }
+#endif
+    fetch_and_and(&queued[channel], ~(1ull << pid));
+    synchronize();
+    return &processes[pid];
+}
+
+bool waitq_is_empty(uint64_t channel)
+{
+    kassert(channel < N_CHANNELS);
+    return queued[channel] == 0;
+}